@@ -8,9 +8,9 @@
  * 64-bit compatible versions of bitmap operations
  */
 
-static inline void clear_block(void *addr)
+static inline void clear_block(void *addr, int size)
 {
-	memset(addr, 0, BLOCK_SIZE);
+	memset(addr, 0, size);
 }
 
 static inline int set_bit(int nr, void *addr)
@@ -31,12 +31,12 @@ static inline int clear_bit(int nr, void *addr)
 	return old == 0;  /* returns 1 if bit was already clear */
 }
 
-static inline int find_first_zero(void *addr)
+static inline int find_first_zero(void *addr, int bits)
 {
 	unsigned int *p = (unsigned int *)addr;
 	int i, j;
 	
-	for (i = 0; i < 8192/32; i++) {
+	for (i = 0; i < bits/32; i++) {
 		if (p[i] != 0xFFFFFFFF) {
 			/* Found a word with at least one zero bit */
 			unsigned int val = ~p[i];
@@ -46,13 +46,14 @@ static inline int find_first_zero(void *addr)
 			}
 		}
 	}
-	return 8192;
+	return bits;
 }
 
 void free_block(int dev, int block)
 {
 	struct super_block * sb;
 	struct buffer_head * bh;
+	int bits;
 
 	if (!(sb = get_super(dev)))
 		panic("trying to free block on nonexistent device");
@@ -70,41 +71,42 @@ void free_block(int dev, int block)
 		brelse(bh);
 	}
 	block -= sb->s_firstdatazone - 1 ;
-	if (clear_bit(block&8191,sb->s_zmap[block/8192]->b_data)) {
+	bits = BITS_PER_BLOCK(sb->s_blocksize);
+	if (clear_bit(block%bits,sb->s_zmap[block/bits]->b_data)) {
 		printk("block (%04x:%d) ",dev,block+sb->s_firstdatazone-1);
 		panic("free_block: bit already cleared");
 	}
-	sb->s_zmap[block/8192]->b_dirt = 1;
+	mark_buffer_dirty(sb->s_zmap[block/bits]);
 }
 
 int new_block(int dev)
 {
 	struct buffer_head * bh;
 	struct super_block * sb;
-	int i,j;
+	int i,j,bits;
 
 	if (!(sb = get_super(dev)))
 		panic("trying to get new block from nonexistant device");
-	j = 8192;
-	for (i=0 ; i<8 ; i++)
+	j = bits = BITS_PER_BLOCK(sb->s_blocksize);
+	for (i=0 ; i<Z_MAP_SLOTS ; i++)
 		if (bh=sb->s_zmap[i])
-			if ((j=find_first_zero(bh->b_data))<8192)
+			if ((j=find_first_zero(bh->b_data,bits))<bits)
 				break;
-	if (i>=8 || !bh || j>=8192)
+	if (i>=Z_MAP_SLOTS || !bh || j>=bits)
 		return 0;
 	if (set_bit(j,bh->b_data))
 		panic("new_block: bit already set");
-	bh->b_dirt = 1;
-	j += i*8192 + sb->s_firstdatazone-1;
+	mark_buffer_dirty(bh);
+	j += i*bits + sb->s_firstdatazone-1;
 	if (j >= sb->s_nzones)
 		return 0;
 	if (!(bh=getblk(dev,j)))
 		panic("new_block: cannot get block");
 	if (bh->b_count != 1)
 		panic("new block: count is != 1");
-	clear_block(bh->b_data);
+	clear_block(bh->b_data,bh->b_size);
 	bh->b_uptodate = 1;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	brelse(bh);
 	return j;
 }
@@ -113,6 +115,7 @@ void free_inode(struct m_inode * inode)
 {
 	struct super_block * sb;
 	struct buffer_head * bh;
+	int bits;
 
 	if (!inode)
 		return;
@@ -130,11 +133,12 @@ void free_inode(struct m_inode * inode)
 		panic("trying to free inode on nonexistent device");
 	if (inode->i_num < 1 || inode->i_num > sb->s_ninodes)
 		panic("trying to free inode 0 or nonexistant inode");
-	if (!(bh=sb->s_imap[inode->i_num>>13]))
+	bits = BITS_PER_BLOCK(sb->s_blocksize);
+	if (!(bh=sb->s_imap[inode->i_num/bits]))
 		panic("nonexistent imap in superblock");
-	if (clear_bit(inode->i_num&8191,bh->b_data))
+	if (clear_bit(inode->i_num%bits,bh->b_data))
 		panic("free_inode: bit already cleared");
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	memset(inode,0,sizeof(*inode));
 }
 
@@ -143,29 +147,29 @@ struct m_inode * new_inode(int dev)
 	struct m_inode * inode;
 	struct super_block * sb;
 	struct buffer_head * bh;
-	int i,j;
+	int i,j,bits;
 
 	if (!(inode=get_empty_inode()))
 		return NULL;
 	if (!(sb = get_super(dev)))
 		panic("new_inode with unknown device");
-	j = 8192;
-	for (i=0 ; i<8 ; i++)
+	j = bits = BITS_PER_BLOCK(sb->s_blocksize);
+	for (i=0 ; i<I_MAP_SLOTS ; i++)
 		if (bh=sb->s_imap[i])
-			if ((j=find_first_zero(bh->b_data))<8192)
+			if ((j=find_first_zero(bh->b_data,bits))<bits)
 				break;
-	if (!bh || j >= 8192 || j+i*8192 > sb->s_ninodes) {
+	if (!bh || j >= bits || j+i*bits > sb->s_ninodes) {
 		iput(inode);
 		return NULL;
 	}
 	if (set_bit(j,bh->b_data))
 		panic("new_inode: bit already set");
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	inode->i_count=1;
 	inode->i_nlinks=1;
 	inode->i_dev=dev;
 	inode->i_dirt=1;
-	inode->i_num = j + i*8192;
+	inode->i_num = j + i*bits;
 	inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
 	return inode;
 }
@@ -1,25 +1,34 @@
 #include <errno.h>
+#include <fcntl.h>
 
 #include <linux/fs.h>
 #include <linux/kernel.h>
+#include <linux/blkdev.h>
 #include <asm/segment.h>
 
-#define NR_BLK_DEV ((sizeof (rd_blk))/(sizeof (rd_blk[0])))
-
-int block_write(int dev, long * pos, char * buf, int count)
+int block_write(int dev, struct file * filp, char * buf, int count)
 {
-	int block = *pos / BLOCK_SIZE;
-	int offset = *pos % BLOCK_SIZE;
+	off_t * pos = &filp->f_pos;
+	int size = blocksize(dev);
+	int block, offset;
 	int chars;
 	int written = 0;
 	struct buffer_head * bh;
 	register char * p;
 
+	if (filp->f_flags & O_DIRECT) {
+		if ((written = direct_io(WRITE,NULL,dev,pos,buf,count)) < 0)
+			return written;
+		buf += written;
+		count -= written;
+	}
+	block = *pos / size;
+	offset = *pos % size;
 	while (count>0) {
 		bh = bread(dev,block);
 		if (!bh)
 			return written?written:-EIO;
-		chars = (count<BLOCK_SIZE) ? count : BLOCK_SIZE;
+		chars = (count<size-offset) ? count : size-offset;
 		p = offset + bh->b_data;
 		offset = 0;
 		block++;
@@ -28,26 +37,37 @@ int block_write(int dev, long * pos, char * buf, int count)
 		count -= chars;
 		while (chars-->0)
 			*(p++) = get_fs_byte(buf++);
-		bh->b_dirt = 1;
+		mark_buffer_dirty(bh);
 		brelse(bh);
+		balance_dirty(dev);
 	}
 	return written;
 }
 
-int block_read(int dev, unsigned long * pos, char * buf, int count)
+int block_read(int dev, struct file * filp, char * buf, int count)
 {
-	int block = *pos / BLOCK_SIZE;
-	int offset = *pos % BLOCK_SIZE;
+	off_t * pos = &filp->f_pos;
+	int size = blocksize(dev);
+	int block, offset;
 	int chars;
 	int read = 0;
 	struct buffer_head * bh;
 	register char * p;
 
+	if (filp->f_flags & O_DIRECT) {
+		if ((read = direct_io(READ,NULL,dev,pos,buf,count)) < 0)
+			return read;
+		buf += read;
+		count -= read;
+	}
+	block = *pos / size;
+	offset = *pos % size;
 	while (count>0) {
 		bh = bread(dev,block);
 		if (!bh)
 			return read?read:-EIO;
-		chars = (count<BLOCK_SIZE) ? count : BLOCK_SIZE;
+		readahead(filp,NULL,dev,block);
+		chars = (count<size-offset) ? count : size-offset;
 		p = offset + bh->b_data;
 		offset = 0;
 		block++;
@@ -56,31 +76,46 @@ int block_read(int dev, unsigned long * pos, char * buf, int count)
 		count -= chars;
 		while (chars-->0)
 			put_fs_byte(*(p++),buf++);
-		bh->b_dirt = 1;
 		brelse(bh);
 	}
 	return read;
 }
 
-extern void rw_hd(int rw, struct buffer_head * bh);
+/*
+ * blksize_size[major][minor] is the block size the buffer cache uses
+ * for a device. Drivers that can do more than BLOCK_SIZE provide the
+ * table; for the others it stays NULL, and BLOCK_SIZE it is.
+ */
+int * blksize_size[NR_BLK_DEV] = {NULL, };
 
-typedef void (*blk_fn)(int rw, struct buffer_head * bh);
+int blocksize(int dev)
+{
+	unsigned int major = MAJOR(dev);
 
-static blk_fn rd_blk[]={
-	NULL,		/* nodev */
-	NULL,		/* dev mem */
-	NULL,		/* dev fd */
-	rw_hd,		/* dev hd */
-	NULL,		/* dev ttyx */
-	NULL,		/* dev tty */
-	NULL};		/* dev lp */
+	if (major >= NR_BLK_DEV || !blksize_size[major] ||
+	    !blksize_size[major][MINOR(dev)])
+		return BLOCK_SIZE;
+	return blksize_size[major][MINOR(dev)];
+}
 
-void ll_rw_block(int rw, struct buffer_head * bh)
+/*
+ * set_blocksize() changes the block size of a device, which may be
+ * 1, 2 or 4kB. Buffers of the old size are written out and dropped
+ * first, as the block numbers in them mean something else now. If some
+ * are still in use it is -EBUSY, and the size stays as it was.
+ */
+int set_blocksize(int dev, int size)
 {
-	blk_fn blk_addr;
-	unsigned int major;
+	unsigned int major = MAJOR(dev);
 
-	if ((major=MAJOR(bh->b_dev)) >= NR_BLK_DEV || !(blk_addr=rd_blk[major]))
-		panic("Trying to read nonexistent block-device");
-	blk_addr(rw, bh);
+	if (size != 1024 && size != 2048 && size != 4096)
+		return -EINVAL;
+	if (blocksize(dev) == size)
+		return 0;
+	if (major >= NR_BLK_DEV || !blksize_size[major])
+		return -EINVAL;
+	if (invalidate_buffers(dev))
+		return -EBUSY;
+	blksize_size[major][MINOR(dev)] = size;
+	return 0;
 }
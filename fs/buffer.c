@@ -9,6 +9,7 @@
 #include <linux/config.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <asm/system.h>
 
 #if (BUFFER_END & 0xfff)
@@ -19,13 +20,78 @@
 #error "Bad BUFFER_END value"
 #endif
 
+#if (NR_HASH < 2*HIGH_MEMORY/BLOCK_SIZE || (NR_HASH & (NR_HASH-1)))
+#error "NR_HASH must be a power of two, twice the buffers HIGH_MEMORY holds"
+#endif
+
 extern int end;
 struct buffer_head * start_buffer = (struct buffer_head *) &end;
-struct buffer_head * hash_table[NR_HASH];
-static struct buffer_head * free_list;
+static struct buffer_head * clock_hand;
 static struct task_struct * buffer_wait = NULL;
 int NR_BUFFERS = 0;
 
+static struct buffer_head * find_buffer(int dev, int block);
+
+/*
+ * Besides the fixed buffers below BUFFER_END, the cache can take pages
+ * from the page allocator: it grows into up to buffer_target of them on
+ * misses, more only if every buffer is busy, and gives them back when
+ * get_free_page() runs low. Heads for such buffers come from pages too,
+ * and are kept on unused_list when their buffers go away.
+ */
+int buffer_pages = 0;
+int buffer_target = 0;
+static struct buffer_head * unused_list = NULL;
+static int nr_unused = 0;
+
+/*
+ * Statistics: buffer_stats[0] is for all devices together, the rest are
+ * handed out to devices as they show up. Devices beyond the first
+ * NR_BSTAT are only counted in the total.
+ */
+struct buffer_stats buffer_stats[NR_BSTAT+1];
+
+static struct buffer_stats * dev_stats(int dev)
+{
+	struct buffer_stats * s;
+
+	if (!dev)
+		return NULL;
+	for (s = buffer_stats+1 ; s < buffer_stats+NR_BSTAT+1 ; s++)
+		if (s->bs_dev == dev || !s->bs_dev) {
+			s->bs_dev = dev;
+			return s;
+		}
+	return NULL;
+}
+
+#define count(dev,field) do { \
+	struct buffer_stats * __s = dev_stats(dev); \
+	buffer_stats[0].field++; \
+	if (__s) \
+		__s->field++; \
+} while (0)
+
+/*
+ * Tunables for the bdflush task: every bdflush_interval ticks it writes
+ * out buffers that have been dirty for at least bdflush_age ticks, but
+ * never more than bdflush_max of them in one pass.
+ */
+long bdflush_age = BDFLUSH_AGE;
+long bdflush_interval = BDFLUSH_INTERVAL;
+int bdflush_max = BDFLUSH_MAX;
+struct task_struct * bdflush_wait = NULL;
+
+/*
+ * A task that writes through the cache may keep at most dirty_ratio
+ * percent of the buffers dirty; beyond that, balance_dirty() makes it
+ * write back old data itself before it can dirty more.
+ */
+int dirty_ratio = DIRTY_RATIO;
+
+/* buffers flush_old_buffers() has started writing that aren't done yet */
+int nr_writeback = 0;
+
 static inline void wait_on_buffer(struct buffer_head * bh)
 {
 	cli();
@@ -34,83 +100,564 @@ static inline void wait_on_buffer(struct buffer_head * bh)
 	sti();
 }
 
-int sys_sync(void)
+/*
+ * Dirty buffers are also kept on a list of their own, oldest first, so
+ * that writing them out costs time proportional to the amount of dirty
+ * data and not to the size of the cache. Interrupts clear b_dirt when a
+ * write completes but never touch the list: clean buffers are simply
+ * dropped from it the next time somebody walks past them.
+ */
+static struct buffer_head * dirty_head = NULL;
+static struct buffer_head * dirty_tail = NULL;
+int nr_dirty = 0;		/* on the list, some maybe clean already */
+
+static inline int on_dirty_list(struct buffer_head * bh)
 {
-	int i;
-	struct buffer_head * bh;
+	return bh->b_prev_dirty || dirty_head == bh;
+}
 
-	sync_inodes();		/* write out inodes into buffers */
-	bh = start_buffer;
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		wait_on_buffer(bh);
-		if (bh->b_dirt)
-			ll_rw_block(WRITE,bh);
-	}
+static inline void remove_from_dirty(struct buffer_head * bh)
+{
+	if (bh->b_next_dirty)
+		bh->b_next_dirty->b_prev_dirty = bh->b_prev_dirty;
+	else
+		dirty_tail = bh->b_prev_dirty;
+	if (bh->b_prev_dirty)
+		bh->b_prev_dirty->b_next_dirty = bh->b_next_dirty;
+	else
+		dirty_head = bh->b_next_dirty;
+	bh->b_next_dirty = bh->b_prev_dirty = NULL;
+	nr_dirty--;
+}
+
+static inline void insert_into_dirty(struct buffer_head * bh)
+{
+	bh->b_next_dirty = NULL;
+	bh->b_prev_dirty = dirty_tail;
+	if (dirty_tail)
+		dirty_tail->b_next_dirty = bh;
+	else
+		dirty_head = bh;
+	dirty_tail = bh;
+	nr_dirty++;
+}
+
+/*
+ * mark_buffer_dirty() must be used instead of setting b_dirt by hand, so
+ * that the buffer gets on the dirty list and we know for how long it has
+ * been dirty. Only the first write after a clean period counts: a buffer
+ * that keeps getting dirtied must not be able to dodge the flusher.
+ */
+void mark_buffer_dirty(struct buffer_head * bh)
+{
+	if (bh->b_dirt)
+		return;
+	bh->b_dirt = 1;
+	bh->b_dirtime = jiffies;
+	if (on_dirty_list(bh))
+		remove_from_dirty(bh);
+	insert_into_dirty(bh);
+}
+
+/*
+ * write_dirty() writes out the buffers of device dev (or of all devices
+ * if dev is 0) that were dirtied at or before 'until', but at most 'max'
+ * of them. As the list is in b_dirtime order, it can stop at the first
+ * buffer that is too young. Each buffer taken brings along the dirty
+ * blocks that directly follow it on disk, so that ll_rw_blocks() can
+ * send the whole run as one request. The list changes while we sleep,
+ * so every batch starts from the head again.
+ *
+ * If async is set, write_dirty() doesn't wait for the writes: the
+ * buffers stay locked until end_writeback() has seen them done, and
+ * are taken off the dirty list by a later pass. Locked buffers are
+ * skipped then, as they are being written already.
+ */
+static inline int in_batch(struct buffer_head * bh,
+	struct buffer_head ** batch, int n)
+{
+	while (n-- > 0)
+		if (batch[n] == bh)
+			return 1;
 	return 0;
 }
 
-static int sync_dev(int dev)
+static void end_writeback(struct buffer_head * bh, int uptodate)
 {
-	int i;
-	struct buffer_head * bh;
+	if (!uptodate && bh->b_dirt)
+		printk("write error on %04x:%d\n",bh->b_dev,bh->b_blocknr);
+	nr_writeback--;
+}
 
-	bh = start_buffer;
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		if (bh->b_dev != dev)
+static int write_dirty(int dev, long until, int max, int async)
+{
+	struct buffer_head * bh, * tmp, * next, * batch[NR_BATCH];
+	int i, n, nr = 0;
+
+repeat:
+	n = 0;
+	for (bh = dirty_head ; bh && nr+n < max && n < NR_BATCH ; bh = next) {
+		next = bh->b_next_dirty;
+		if (!bh->b_dirt) {
+			remove_from_dirty(bh);
+			continue;
+		}
+		if (bh->b_dirtime > until)
+			break;
+		if (dev && bh->b_dev != dev)
+			continue;
+		if (in_batch(bh,batch,n) || (async && bh->b_lock))
 			continue;
-		wait_on_buffer(bh);
-		if (bh->b_dirt)
-			ll_rw_block(WRITE,bh);
+		bh->b_count++;
+		batch[n++] = bh;
+		for (i=1 ; nr+n < max && n < NR_BATCH ; i++) {
+			if (!(tmp=find_buffer(bh->b_dev,bh->b_blocknr+i)))
+				break;
+			if (!tmp->b_dirt || tmp->b_lock || in_batch(tmp,batch,n))
+				break;
+			tmp->b_count++;
+			batch[n++] = tmp;
+		}
 	}
+	if (!n)
+		return nr;
+	if (async) {
+		cli();
+		nr_writeback += n;
+		sti();
+		submit_blocks(WRITE,n,batch,end_writeback,NULL);
+		for (i=0 ; i<n ; i++)
+			batch[i]->b_count--;
+		wake_up(&buffer_wait);
+		nr += n;
+		goto repeat;
+	}
+	ll_rw_blocks(WRITE,n,batch);
+	for (i=0 ; i<n ; i++) {
+		bh = batch[i];
+		if (on_dirty_list(bh) && !bh->b_dirt)
+			remove_from_dirty(bh);
+		brelse(bh);
+	}
+	nr += n;
+	goto repeat;
+}
+
+int sys_sync(void)
+{
+	save_hot_blocks();
+	sync_inodes();		/* write out inodes into buffers */
+	write_dirty(0,jiffies,NR_BUFFERS,0);
 	return 0;
 }
 
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
-#define hash(dev,block) hash_table[_hashfn(dev,block)]
+int sync_dev(int dev)
+{
+	write_dirty(dev,jiffies,NR_BUFFERS,0);
+	return 0;
+}
 
-static inline void remove_from_queues(struct buffer_head * bh)
+
+/*
+ * balance_dirty() is called by file_write() and block_write() after they
+ * have dirtied a buffer. Once more than dirty_ratio percent of the cache
+ * is dirty, the writer writes back the oldest dirty buffers itself, a
+ * batch at a time, until it is under the limit again: a bulk writer is
+ * slowed down to the speed of the disk, instead of filling the cache and
+ * leaving everybody else's getblk() to wait for the write-back. Buffers
+ * whose writes fail stay dirty, so it gives up once a batch doesn't
+ * bring the count down.
+ */
+void balance_dirty(int dev)
+{
+	int limit = NR_BUFFERS * dirty_ratio / 100;
+	int last;
+
+	if (nr_dirty <= limit)
+		return;
+	count(dev,bs_throttled);
+	do {
+		last = nr_dirty;
+		if (!write_dirty(0,jiffies,NR_BATCH,0))
+			break;
+	} while (nr_dirty > limit && nr_dirty < last);
+}
+
+/*
+ * flush_old_buffers() starts writing out buffers that have been dirty for
+ * more than bdflush_age ticks, at most bdflush_max of them. It doesn't
+ * wait for them, so bdflush sleeps only when the queues are full.
+ */
+int flush_old_buffers(void)
+{
+	return write_dirty(0,jiffies-bdflush_age,bdflush_max,1);
+}
+
+/*
+ * bdflush() is the body of the buffer flushing task. do_timer() wakes it
+ * up every bdflush_interval ticks, so foreground tasks seldom have to
+ * write out old dirty buffers themselves.
+ */
+void bdflush(void)
+{
+	sti();
+	for (;;) {
+		flush_old_buffers();
+		sleep_on(&bdflush_wait);
+	}
+}
+
+/*
+ * The hash index is kept apart from the buffer heads, so that a lookup
+ * doesn't have to drag whole heads into the cache just to compare their
+ * keys: it is an open-addressed table of (dev, block, buffer) entries,
+ * four to a cache line, with linear probing. Only the first 1<<hash_bits
+ * entries are in use, and resize_hash() keeps that at least twice
+ * NR_BUFFERS, so probe sequences stay short and always end in an empty
+ * slot. The hash is multiplicative, so that neither the device number
+ * nor runs of consecutive blocks end up piling onto a few slots: the key
+ * is mixed by multiplying with 2^32/phi, and the top bits taken.
+ */
+#define MIN_HASH_BITS 8
+static int hash_bits = MIN_HASH_BITS;
+
+#define _hashfn(dev,block) \
+((((unsigned)(block) ^ ((unsigned)(dev) * 0x85EBCA6Bu)) * 0x9E3779B9u) \
+	>> (32-hash_bits))
+#define hash_mask ((1<<hash_bits)-1)
+
+struct hash_entry {
+	unsigned int h_block;
+	unsigned short h_dev;
+	struct buffer_head * h_bh;	/* NULL = empty slot */
+};
+
+static struct hash_entry hash_table[NR_HASH] __attribute__((aligned(64)));
+
+/* find_buffer() calls, and the slots they looked at */
+unsigned long hash_lookups = 0;
+unsigned long hash_probes = 0;
+
+static inline void insert_into_hash(struct buffer_head * bh)
+{
+	struct hash_entry * h;
+	int i = _hashfn(bh->b_dev,bh->b_blocknr);
+
+	while ((h = hash_table+i)->h_bh)
+		i = (i+1) & hash_mask;
+	h->h_block = bh->b_blocknr;
+	h->h_dev = bh->b_dev;
+	h->h_bh = bh;
+}
+
+/*
+ * remove_from_hash() doesn't leave a tombstone: it moves later entries of
+ * the probe sequence back into the hole when that keeps them reachable,
+ * so that lookups can still stop at the first empty slot. Buffers that
+ * aren't hashed are simply not found.
+ */
+static inline void remove_from_hash(struct buffer_head * bh)
+{
+	int i = _hashfn(bh->b_dev,bh->b_blocknr), j, k;
+
+	for ( ; hash_table[i].h_bh != bh ; i = (i+1) & hash_mask)
+		if (!hash_table[i].h_bh)
+			return;
+	for (j = i ; ; ) {
+		j = (j+1) & hash_mask;
+		if (!hash_table[j].h_bh)
+			break;
+		k = _hashfn(hash_table[j].h_dev,hash_table[j].h_block);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		hash_table[i] = hash_table[j];
+		i = j;
+	}
+	hash_table[i].h_bh = NULL;
+}
+
+/*
+ * The buffers are kept on a fixed ring (b_next_free/b_prev_free) that the
+ * clock hand goes round in getblk(). Only the hash index changes when a
+ * buffer gets a new block.
+ */
+static inline void insert_into_ring(struct buffer_head * bh)
+{
+	bh->b_next_free = clock_hand;
+	bh->b_prev_free = clock_hand->b_prev_free;
+	clock_hand->b_prev_free->b_next_free = bh;
+	clock_hand->b_prev_free = bh;
+}
+
+static inline void remove_from_ring(struct buffer_head * bh)
 {
-/* remove from hash-queue */
-	if (bh->b_next)
-		bh->b_next->b_prev = bh->b_prev;
-	if (bh->b_prev)
-		bh->b_prev->b_next = bh->b_next;
-	if (hash(bh->b_dev,bh->b_blocknr) == bh)
-		hash(bh->b_dev,bh->b_blocknr) = bh->b_next;
-/* remove from free list */
-	if (!(bh->b_prev_free) || !(bh->b_next_free))
-		panic("Free block list corrupted");
+	if (clock_hand == bh)
+		clock_hand = bh->b_next_free;
 	bh->b_prev_free->b_next_free = bh->b_next_free;
 	bh->b_next_free->b_prev_free = bh->b_prev_free;
-	if (free_list == bh)
-		free_list = bh->b_next_free;
+	bh->b_prev_free = bh->b_next_free = NULL;
 }
 
-static inline void insert_into_queues(struct buffer_head * bh)
+/*
+ * A buffer of another size than the device's is one set_blocksize()
+ * couldn't drop: its block number means another place on the disk now,
+ * so it is passed over until it is let go of and reused.
+ */
+static struct buffer_head * find_buffer(int dev, int block)
 {
-/* put at end of free list */
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
-/* put the buffer in new hash-queue if it has a device */
-	bh->b_prev = NULL;
-	bh->b_next = NULL;
-	if (!bh->b_dev)
+	struct hash_entry * h;
+	int i = _hashfn(dev,block);
+
+	hash_lookups++;
+	for ( ; ; i = (i+1) & hash_mask) {
+		h = hash_table+i;
+		hash_probes++;
+		if (!h->h_bh)
+			return NULL;
+		if (h->h_block == block && h->h_dev == dev &&
+		    h->h_bh->b_size == blocksize(dev))
+			return h->h_bh;
+	}
+}
+
+/*
+ * resize_hash() is called whenever NR_BUFFERS has changed. It doubles
+ * the table when it is more than half full, and halves it when it is
+ * less than an eighth full, rehashing every buffer on the ring. That
+ * doesn't happen often enough to be worth doing lazily.
+ */
+static void resize_hash(void)
+{
+	struct buffer_head * bh;
+	int i, bits = hash_bits, old = 1<<hash_bits;
+
+	if (2*NR_BUFFERS > (1<<bits))
+		while ((1<<bits) < 2*NR_BUFFERS && (1<<bits) < NR_HASH)
+			bits++;
+	else if (8*NR_BUFFERS < (1<<bits))
+		while (bits > MIN_HASH_BITS && 2*NR_BUFFERS <= (1<<(bits-1)))
+			bits--;
+	if (bits == hash_bits)
 		return;
-	bh->b_next = hash(bh->b_dev,bh->b_blocknr);
-	hash(bh->b_dev,bh->b_blocknr) = bh;
-	bh->b_next->b_prev = bh;
+	hash_bits = bits;
+	for (i=0 ; i<old || i<(1<<bits) ; i++)
+		hash_table[i].h_bh = NULL;
+	bh = clock_hand;
+	do {
+		if (bh->b_dev)
+			insert_into_hash(bh);
+		bh = bh->b_next_free;
+	} while (bh != clock_hand);
 }
 
-static struct buffer_head * find_buffer(int dev, int block)
-{		
-	struct buffer_head * tmp;
+void reset_buffer_stats(void)
+{
+	int i;
 
-	for (tmp = hash(dev,block) ; tmp != NULL ; tmp = tmp->b_next)
-		if (tmp->b_dev==dev && tmp->b_blocknr==block)
-			return tmp;
-	return NULL;
+	for (i=0 ; i<NR_BSTAT+1 ; i++) {
+		buffer_stats[i].bs_dev = 0;
+		buffer_stats[i].bs_hits = 0;
+		buffer_stats[i].bs_misses = 0;
+		buffer_stats[i].bs_evict_clean = 0;
+		buffer_stats[i].bs_evict_dirty = 0;
+		buffer_stats[i].bs_evict_cluster = 0;
+		buffer_stats[i].bs_reads = 0;
+		buffer_stats[i].bs_waits = 0;
+		buffer_stats[i].bs_readahead = 0;
+		buffer_stats[i].bs_ra_hits = 0;
+		buffer_stats[i].bs_throttled = 0;
+	}
+	hash_lookups = hash_probes = 0;
+	page_hits = page_misses = 0;
+}
+
+/*
+ * hash_index_stats() returns the longest probe sequence in the index,
+ * that is how many slots a lookup of the worst placed buffer looks at.
+ * The size of the index, the number of buffers in it and the total of
+ * their probe lengths are put in *size, *used and *probes, so that the
+ * average hit costs *probes / *used slots.
+ */
+int hash_index_stats(int * size, int * used, int * probes)
+{
+	struct hash_entry * h;
+	int i, len, max = 0;
+
+	*size = 1<<hash_bits;
+	*used = *probes = 0;
+	for (i=0 ; i<*size ; i++) {
+		if (!(h = hash_table+i)->h_bh)
+			continue;
+		len = ((i - (int) _hashfn(h->h_dev,h->h_block)) & hash_mask) + 1;
+		(*used)++;
+		*probes += len;
+		if (len > max)
+			max = len;
+	}
+	return max;
+}
+
+/*
+ * hash_bench() times find_buffer(): it picks up to *nr of the blocks in
+ * the cache (the number actually used is put back in *nr) and looks
+ * them all up 'rounds' times over, returning the TSC cycles taken. With
+ * miss set, the same keys are looked up with a block number that isn't
+ * cached. The keys are kept on pages of their own, so that all the
+ * benchmark touches is the index.
+ */
+#define BENCH_KEYS (PAGE_SIZE/sizeof(struct hash_entry))
+#define BENCH_PAGES 8
+
+unsigned long hash_bench(int * nr, int rounds, int miss)
+{
+	struct hash_entry * keys[BENCH_PAGES], * k;
+	struct buffer_head * bh;
+	unsigned long start, end, lookups = hash_lookups, probes = hash_probes;
+	int i, n;
+
+	for (i=0 ; i<BENCH_PAGES ; i++)
+		keys[i] = NULL;
+	if (*nr > BENCH_PAGES*BENCH_KEYS)
+		*nr = BENCH_PAGES*BENCH_KEYS;
+	for (i=0 ; i*BENCH_KEYS < *nr ; i++)
+		if (!(keys[i] = (struct hash_entry *) get_free_page()))
+			break;
+	if (*nr > i*BENCH_KEYS)
+		*nr = i*BENCH_KEYS;
+	n = 0;
+	bh = clock_hand;
+	do {
+		if (n >= *nr)
+			break;
+		if (bh->b_dev) {
+			k = keys[n/BENCH_KEYS] + n%BENCH_KEYS;
+			k->h_dev = bh->b_dev;
+			k->h_block = bh->b_blocknr + (miss ? 0x40000000 : 0);
+			n++;
+		}
+		bh = bh->b_next_free;
+	} while (bh != clock_hand);
+	*nr = n;
+	start = rdtsc();
+	while (rounds-- > 0)
+		for (i=0 ; i<n ; i++) {
+			k = keys[i/BENCH_KEYS] + i%BENCH_KEYS;
+			find_buffer(k->h_dev,k->h_block);
+		}
+	end = rdtsc();
+	for (i=0 ; i<BENCH_PAGES ; i++)
+		if (keys[i])
+			free_page((unsigned long) keys[i]);
+	hash_lookups = lookups;
+	hash_probes = probes;
+	return end - start;
+}
+
+/*
+ * write_victim() writes out a dirty buffer that getblk() wants to reuse,
+ * plus any unused dirty buffers directly following it on the same device
+ * (up to NR_CLUSTER blocks in all, sent as one request). Unlike sync_dev()
+ * this doesn't go through the whole cache just to free one buffer. The
+ * caller holds a reference to bh, so it can't change under us while we
+ * sleep.
+ */
+static void write_victim(struct buffer_head * bh)
+{
+	struct buffer_head * tmp, * batch[NR_CLUSTER];
+	int dev = bh->b_dev;
+	int block = bh->b_blocknr;
+	int i, n;
+
+	batch[0] = bh;
+	count(dev,bs_evict_dirty);
+	for (n=1 ; n<NR_CLUSTER ; n++) {
+		if (!(tmp=find_buffer(dev,block+n)))
+			break;
+		if (tmp->b_count || tmp->b_lock || !tmp->b_dirt)
+			break;
+		tmp->b_count++;
+		batch[n] = tmp;
+		count(dev,bs_evict_cluster);
+	}
+	ll_rw_blocks(WRITE,n,batch);
+	for (i=1 ; i<n ; i++)
+		brelse(batch[i]);
+}
+
+/*
+ * invalidate_buffers() writes out the buffers of a device and then
+ * forgets about them, so that the next getblk() has to go to the disk.
+ * Buffers that are in use can't go: they are complained about, and it
+ * returns how many there were.
+ */
+int invalidate_buffers(int dev)
+{
+	struct buffer_head * bh;
+	int i, busy;
+
+	sync_dev(dev);
+repeat:
+	busy = 0;
+	bh = start_buffer;
+	for (i=0 ; i<NR_BUFFERS ; i++,bh=bh->b_next_free) {
+		if (bh->b_dev != dev)
+			continue;
+		if (bh->b_lock) {
+			wait_on_buffer(bh);
+			goto repeat;
+		}
+		if (bh->b_count) {
+			printk("invalidate_buffers: busy buffer (%04x:%d)\n",
+				dev,bh->b_blocknr);
+			busy++;
+			continue;
+		}
+		remove_from_hash(bh);
+		if (on_dirty_list(bh))
+			remove_from_dirty(bh);
+		bh->b_dev = 0;
+		bh->b_uptodate = 0;
+		bh->b_dirt = 0;
+	}
+	return busy;
+}
+
+/*
+ * hot_blocks() fills blocks[] with the (up to) nr cached blocks of dev
+ * that were hit most often, in ascending order, and returns how many
+ * it found. Blocks hit less than twice aren't worth remembering.
+ */
+int hot_blocks(int dev, unsigned int * blocks, int nr)
+{
+	static unsigned short hits[NR_HOT];
+	struct buffer_head * bh;
+	unsigned int block;
+	int i, j, n = 0;
+
+	if (nr > NR_HOT)
+		nr = NR_HOT;
+	if (nr <= 0)
+		return 0;
+	bh = start_buffer;
+	for (i=0 ; i<NR_BUFFERS ; i++,bh=bh->b_next_free) {
+		if (bh->b_dev != dev || !bh->b_uptodate || bh->b_hits < 2)
+			continue;
+		if (n == nr && bh->b_hits <= hits[n-1])
+			continue;
+		for (j = (n<nr)?n++:n-1 ; j && hits[j-1] < bh->b_hits ; j--) {
+			hits[j] = hits[j-1];
+			blocks[j] = blocks[j-1];
+		}
+		hits[j] = bh->b_hits;
+		blocks[j] = bh->b_blocknr;
+	}
+	for (i=1 ; i<n ; i++) {
+		block = blocks[i];
+		for (j=i ; j && blocks[j-1] > block ; j--)
+			blocks[j] = blocks[j-1];
+		blocks[j] = block;
+	}
+	return n;
 }
 
 /*
@@ -125,71 +672,264 @@ struct buffer_head * get_hash_table(int dev, int block)
 	struct buffer_head * bh;
 
 repeat:
-	if (!(bh=find_buffer(dev,block)))
+	if (!(bh=find_buffer(dev,block))) {
+		count(dev,bs_misses);
 		return NULL;
+	}
 	bh->b_count++;
 	wait_on_buffer(bh);
 	if (bh->b_dev != dev || bh->b_blocknr != block) {
 		brelse(bh);
 		goto repeat;
 	}
+	count(dev,bs_hits);
+/*
+ * The first hit on a block that was read ahead is just the read it was
+ * meant for, so it doesn't make the block hot.
+ */
+	if (bh->b_reada) {
+		bh->b_reada = 0;
+		count(dev,bs_ra_hits);
+	} else {
+		bh->b_ref = 1;
+		if (bh->b_hits < 0xffff)
+			bh->b_hits++;
+	}
 	return bh;
 }
 
+static void init_buffer(struct buffer_head * bh, char * data, int size)
+{
+	bh->b_data = data;
+	bh->b_size = size;
+	bh->b_dev = 0;
+	bh->b_blocknr = 0;
+	bh->b_dirt = 0;
+	bh->b_dirtime = 0;
+	bh->b_prev_dirty = NULL;
+	bh->b_next_dirty = NULL;
+	bh->b_count = 0;
+	bh->b_lock = 0;
+	bh->b_ref = 0;
+	bh->b_reada = 0;
+	bh->b_hits = 0;
+	bh->b_poll = 0;
+	bh->b_uptodate = 0;
+	bh->b_wait = NULL;
+	bh->b_this_page = NULL;
+	bh->b_reqnext = NULL;
+	bh->b_end_io = NULL;
+	bh->b_private = NULL;
+}
+
+static int get_more_heads(void)
+{
+	struct buffer_head * bh;
+	int i;
+
+	if (!(bh = (struct buffer_head *) get_free_page()))
+		return 0;
+	for (i=0 ; i<PAGE_SIZE/sizeof(struct buffer_head) ; i++,bh++) {
+		bh->b_next_free = unused_list;
+		unused_list = bh;
+		nr_unused++;
+	}
+	return 1;
+}
+
+/*
+ * grow_buffers() cuts a fresh page into buffers of the given size and puts
+ * them on the ring just before the clock hand, which is then moved back
+ * onto them so that getblk() takes them first. It leaves 'reserve' free
+ * pages alone.
+ */
+static int grow_buffers(int size, int reserve)
+{
+	struct buffer_head * bh, * first = NULL, * last = NULL;
+	unsigned long page;
+	int i;
+
+	if (nr_free_pages < reserve)
+		return 0;
+	while (nr_unused < PAGE_SIZE/size)
+		if (!get_more_heads())
+			return 0;
+	if (!(page = get_free_page()))
+		return 0;
+	for (i=0 ; i<PAGE_SIZE/size ; i++) {
+		bh = unused_list;
+		unused_list = bh->b_next_free;
+		nr_unused--;
+		init_buffer(bh,(char *) page + i*size,size);
+		if (last)
+			last->b_this_page = bh;
+		else
+			first = bh;
+		last = bh;
+		insert_into_ring(bh);
+		NR_BUFFERS++;
+	}
+	last->b_this_page = first;
+	clock_hand = first;
+	buffer_pages++;
+	resize_hash();
+	return 1;
+}
+
+static inline int page_unused(struct buffer_head * bh)
+{
+	struct buffer_head * tmp = bh;
+
+	do {
+		if (tmp->b_count || tmp->b_lock || tmp->b_dirt)
+			return 0;
+		tmp = tmp->b_this_page;
+	} while (tmp != bh);
+	return 1;
+}
+
+/*
+ * shrink_buffers() gives up to nr pages back to the page allocator. It is
+ * called by get_free_page() and may not sleep, so only pages whose buffers
+ * are all unused, unlocked and clean can go. It starts looking at the
+ * clock hand, where the least recently hit buffers are.
+ */
+int shrink_buffers(int nr)
+{
+	struct buffer_head * bh, * tmp, * next;
+	unsigned long page;
+	int i, freed = 0;
+
+	bh = clock_hand;
+	for (i=NR_BUFFERS ; buffer_pages && freed<nr && i>0 ; i--) {
+		if (!bh->b_this_page || !page_unused(bh)) {
+			bh = bh->b_next_free;
+			continue;
+		}
+		page = (unsigned long) bh->b_data & ~(PAGE_SIZE-1);
+		tmp = bh;
+		do {
+			next = tmp->b_this_page;
+			remove_from_hash(tmp);
+			if (on_dirty_list(tmp))
+				remove_from_dirty(tmp);
+			remove_from_ring(tmp);
+			tmp->b_dev = 0;
+			tmp->b_this_page = NULL;
+			tmp->b_next_free = unused_list;
+			unused_list = tmp;
+			nr_unused++;
+			NR_BUFFERS--;
+			tmp = next;
+		} while (tmp != bh);
+		free_page(page);
+		buffer_pages--;
+		freed++;
+		bh = clock_hand;
+	}
+	if (freed)
+		resize_hash();
+	return freed;
+}
+
 /*
  * Ok, this is getblk, and it isn't very clear, again to hinder
  * race-conditions. Most of the code is seldom used, (ie repeating),
  * so it should be much more efficient than it looks.
+ *
+ * Victims are chosen with the CLOCK algorithm: the hand skips buffers in
+ * use, and gives those that have been hit since it last came by (b_ref
+ * set by get_hash_table()) another round. A block read only once, like
+ * the blocks of a big sequential read, never gets b_ref set, so it goes
+ * before metadata that is used over and over. Two rounds are enough to
+ * find any free buffer; if all of those are locked we wait for one.
+ *
+ * Rather than throw out a block that still holds data, the cache grows
+ * a page while it is below buffer_target. When no buffer is free at all
+ * it grows past the target, as long as there are pages to spare.
+ *
+ * Only buffers of the block size of dev will do. The fixed buffers are
+ * all BLOCK_SIZE, so bigger ones always come from pages: if there are
+ * none to be had, a page of unused buffers is given back and cut up
+ * again, dipping into the reserve if need be.
  */
 struct buffer_head * getblk(int dev,int block)
 {
-	struct buffer_head * tmp;
+	struct buffer_head * tmp, * locked;
+	int i, size = blocksize(dev);
 
 repeat:
 	if (tmp=get_hash_table(dev,block))
 		return tmp;
-	tmp = free_list;
-	do {
-		if (!tmp->b_count) {
-			wait_on_buffer(tmp);	/* we still have to wait */
-			if (!tmp->b_count)	/* on it, it might be dirty */
-				break;
+	locked = NULL;
+	tmp = clock_hand;
+	for (i=0 ; i<2*NR_BUFFERS ; i++,tmp=tmp->b_next_free) {
+		if (tmp->b_count || tmp->b_size != size)
+			continue;
+		if (tmp->b_ref) {
+			tmp->b_ref = 0;
+			continue;
+		}
+		if (!tmp->b_lock)
+			break;
+		locked = tmp;
+	}
+	if (i == 2*NR_BUFFERS) {
+		if (grow_buffers(size,2*MIN_FREE_PAGES))
+			goto repeat;
+		if (locked) {
+			wait_on_buffer(locked);
+			goto repeat;
 		}
-		tmp = tmp->b_next_free;
-	} while (tmp != free_list || (tmp=NULL));
-	/* Kids, don't try THIS at home ^^^^^. Magic */
-	if (!tmp) {
+		if (shrink_buffers(1) && grow_buffers(size,MIN_FREE_PAGES))
+			goto repeat;
+		count(dev,bs_waits);
 		printk("Sleeping on free buffer ..");
 		sleep_on(&buffer_wait);
 		printk("ok\n");
 		goto repeat;
 	}
+	if (tmp->b_dev && buffer_pages < buffer_target &&
+	    grow_buffers(size,2*MIN_FREE_PAGES))
+		goto repeat;
+/*
+ * A dirty victim is written out while it is still in the hash-queues, so
+ * nobody can read a stale copy of it from disk in the meantime. After the
+ * write somebody else may have grabbed it, so we just start over - with
+ * the hand on it, so that it is the first one looked at. If the write
+ * failed the data is lost, as it always was: keeping the buffer dirty
+ * would only have us write it again, forever.
+ */
 	tmp->b_count++;
-	remove_from_queues(tmp);
+	if (tmp->b_dirt) {
+		write_victim(tmp);
+		if (tmp->b_dirt && !tmp->b_lock && !tmp->b_uptodate) {
+			printk("getblk: write error on %04x:%d, block lost\n",
+				tmp->b_dev,tmp->b_blocknr);
+			tmp->b_dirt = 0;
+		}
+		brelse(tmp);
+		clock_hand = tmp;
+		goto repeat;
+	}
+	clock_hand = tmp->b_next_free;
+	if (tmp->b_dev)
+		count(tmp->b_dev,bs_evict_clean);
+	remove_from_hash(tmp);
+	if (on_dirty_list(tmp))
+		remove_from_dirty(tmp);
 /*
- * Now, when we know nobody can get to this node (as it's removed from the
- * free list), we write it out. We can sleep here without fear of race-
- * conditions.
+ * Nothing since the get_hash_table() above has slept, so nobody can have
+ * added "this" block behind our back.
  */
-	if (tmp->b_dirt)
-		sync_dev(tmp->b_dev);
-/* update buffer contents */
 	tmp->b_dev=dev;
 	tmp->b_blocknr=block;
 	tmp->b_dirt=0;
 	tmp->b_uptodate=0;
-/* NOTE!! While we possibly slept in sync_dev(), somebody else might have
- * added "this" block already, so check for that. Thank God for goto's.
- */
-	if (find_buffer(dev,block)) {
-		tmp->b_dev=0;		/* ok, someone else has beaten us */
-		tmp->b_blocknr=0;	/* to it - free this block and */
-		tmp->b_count=0;		/* try again */
-		insert_into_queues(tmp);
-		goto repeat;
-	}
-/* and then insert into correct position */
-	insert_into_queues(tmp);
+	tmp->b_ref=0;
+	tmp->b_reada=0;
+	tmp->b_hits=0;
+	insert_into_hash(tmp);
 	return tmp;
 }
 
@@ -215,29 +955,210 @@ struct buffer_head * bread(int dev,int block)
 		panic("bread: getblk returned NULL\n");
 	if (bh->b_uptodate)
 		return bh;
-	ll_rw_block(READ,bh);
+	count(dev,bs_reads);
+	poll_rw_block(READ,bh);
 	if (bh->b_uptodate)
 		return bh;
 	brelse(bh);
 	return (NULL);
 }
 
-void buffer_init(void)
+/*
+ * submit_blocks() queues I/O for a whole array of buffers, so the driver
+ * gets to sort the requests. Neighbouring entries that are consecutive
+ * blocks of the same device are chained through b_reqnext and go to the
+ * driver as one request, NR_BATCH blocks at most (that many 4kB blocks
+ * is all a disk command takes). NULL entries are skipped, as are buffers
+ * that need no I/O: up-to-date ones when reading, clean ones when
+ * writing. A buffer that is already locked has I/O in flight, which for
+ * reads is good enough; writes have to wait for it and try again.
+ *
+ * end_io, if not NULL, is called once for every buffer in bhs[]: when
+ * its I/O is done, or right away if it needed none. Reads of a locked
+ * buffer then wait for it too, so that the callback knows how it went.
+ */
+void submit_blocks(int rw, int nr, struct buffer_head * bhs[],
+	void (*end_io)(struct buffer_head * bh, int uptodate), void * private)
+{
+	struct buffer_head * bh, * head = NULL, * last = NULL;
+	int i, run = 0;
+
+	for (i=0 ; i<nr ; i++) {
+		if (!(bh = bhs[i]))
+			continue;
+		if (bh->b_lock) {
+			if (rw != WRITE && !end_io)
+				continue;
+			if (head)
+				submit_bh(rw,head,end_io,private);
+			head = NULL;
+			wait_on_buffer(bh);
+		}
+		if (rw == WRITE ? !bh->b_dirt : bh->b_uptodate) {
+			if (end_io)
+				end_io(bh,bh->b_uptodate);
+			continue;
+		}
+		if (head && last->b_dev == bh->b_dev &&
+		    last->b_blocknr+1 == bh->b_blocknr && run < NR_BATCH) {
+			last->b_reqnext = bh;
+			last = bh;
+			run++;
+			continue;
+		}
+		if (head)
+			submit_bh(rw,head,end_io,private);
+		head = last = bh;
+		run = 1;
+	}
+	if (head)
+		submit_bh(rw,head,end_io,private);
+}
+
+/*
+ * ll_rw_blocks() is submit_blocks() for callers that want to wait: it
+ * sleeps once for the whole array instead of once per block.
+ */
+void ll_rw_blocks(int rw, int nr, struct buffer_head * bhs[])
+{
+	int i;
+
+	submit_blocks(rw,nr,bhs,NULL,NULL);
+	for (i=0 ; i<nr ; i++)
+		if (bhs[i])
+			wait_on_buffer(bhs[i]);
+}
+
+/*
+ * bread_array() is bread() for nr blocks at once, using ll_rw_blocks().
+ * Zero block numbers are holes and give NULL buffers, and so do blocks
+ * that couldn't be read - callers tell the two apart by the number.
+ */
+void bread_array(int dev, int nr, int * blocks, struct buffer_head * bhs[])
+{
+	int i;
+
+	for (i=0 ; i<nr ; i++) {
+		if (!blocks[i]) {
+			bhs[i] = NULL;
+			continue;
+		}
+		if (!(bhs[i]=getblk(dev,blocks[i])))
+			panic("bread_array: getblk returned NULL\n");
+		if (!bhs[i]->b_uptodate)
+			count(dev,bs_reads);
+	}
+	ll_rw_blocks(READ,nr,bhs);
+	for (i=0 ; i<nr ; i++)
+		if (bhs[i] && !bhs[i]->b_uptodate) {
+			brelse(bhs[i]);
+			bhs[i] = NULL;
+		}
+}
+
+/*
+ * breada() starts reading a block that will probably be needed soon,
+ * unless it is in the cache already. It doesn't wait for the read, so
+ * it drops the buffer without brelse(), which would. READA may be
+ * dropped if the request pool is getting full: the buffer only counts
+ * as read ahead if it was really queued.
+ */
+void breada(int dev,int block)
+{
+	struct buffer_head * bh;
+
+	if (find_buffer(dev,block))
+		return;
+	bh = getblk(dev,block);
+	if (!bh->b_uptodate && !bh->b_lock) {
+		ll_rw_block(READA,bh);
+		if (bh->b_lock || bh->b_uptodate) {	/* not dropped */
+			bh->b_reada = 1;
+			count(dev,bs_readahead);
+		}
+	}
+	bh->b_count--;
+	wake_up(&buffer_wait);
+}
+
+/*
+ * breada_array() is breada() for nr blocks at once: consecutive ones go
+ * to the driver as one request, but nothing is waited for, and blocks
+ * are simply skipped if the request pool is getting full.
+ */
+void breada_array(int dev, int nr, int * blocks)
+{
+	struct buffer_head * bhs[NR_BATCH];
+	int i, n;
+
+	while (nr > 0) {
+		for (n=0 ; n<NR_BATCH && nr>0 ; nr--, blocks++) {
+			if (!*blocks || find_buffer(dev,*blocks))
+				continue;
+			bhs[n++] = getblk(dev,*blocks);
+		}
+		submit_blocks(READA,n,bhs,NULL,NULL);
+		for (i=0 ; i<n ; i++) {
+			if (bhs[i]->b_lock || bhs[i]->b_uptodate) {
+				bhs[i]->b_reada = 1;
+				count(dev,bs_readahead);
+			}
+			bhs[i]->b_count--;
+		}
+		wake_up(&buffer_wait);
+	}
+}
+
+/*
+ * readahead() is called by file_read() and block_read() for every block
+ * they read through filp (block is the block number within the file).
+ * While the reads stay sequential the read-ahead window doubles, up to
+ * RA_MAX blocks; any other access closes it. Only the blocks beyond what
+ * has been read ahead already are started. For regular files (inode is
+ * set) blocks are mapped with bmap(), and we don't go past the end.
+ */
+void readahead(struct file * filp, struct m_inode * inode, int dev, int block)
+{
+	int i, nr;
+
+	if (block+1 == filp->f_ra_next)
+		return;
+	if (block == filp->f_ra_next) {
+		if (!filp->f_ra_win)
+			filp->f_ra_win = RA_MIN;
+		else if (filp->f_ra_win < RA_MAX)
+			filp->f_ra_win <<= 1;
+	} else
+		filp->f_ra_win = 0;
+	filp->f_ra_next = block+1;
+	if (filp->f_ra_end < block+1 || !filp->f_ra_win)
+		filp->f_ra_end = block+1;
+	for (i = filp->f_ra_end ; i < block+1+filp->f_ra_win ; i++) {
+		if (inode) {
+			if (i * blocksize(dev) >= inode->i_size)
+				break;
+			if (!(nr = bmap(inode,i)))
+				continue;
+		} else
+			nr = i;
+		breada(dev,nr);
+	}
+	filp->f_ra_end = i;
+}
+
+/*
+ * buffer_init() sets up the fixed buffers between the end of the kernel
+ * and BUFFER_END, and decides how many pages the cache may take on top
+ * of that: 1/BUFFER_SHARE of the memory that was found.
+ */
+void buffer_init(long memory_end)
 {
 	struct buffer_head * h = start_buffer;
 	void * b = (void *) BUFFER_END;
 	int i;
 
 	while ( (b -= BLOCK_SIZE) >= ((void *) (h+1)) ) {
-		h->b_dev = 0;
-		h->b_dirt = 0;
-		h->b_count = 0;
-		h->b_lock = 0;
-		h->b_uptodate = 0;
-		h->b_wait = NULL;
-		h->b_next = NULL;
-		h->b_prev = NULL;
-		h->b_data = (char *) b;
+		init_buffer(h,(char *) b,BLOCK_SIZE);
 		h->b_prev_free = h-1;
 		h->b_next_free = h+1;
 		h++;
@@ -246,9 +1167,11 @@ void buffer_init(void)
 			b = (void *) 0xA0000;
 	}
 	h--;
-	free_list = start_buffer;
-	free_list->b_prev_free = h;
-	h->b_next_free = free_list;
+	clock_hand = start_buffer;
+	clock_hand->b_prev_free = h;
+	h->b_next_free = clock_hand;
 	for (i=0;i<NR_HASH;i++)
-		hash_table[i]=NULL;
-}	
+		hash_table[i].h_bh=NULL;
+	resize_hash();
+	buffer_target = (memory_end >> 12) / BUFFER_SHARE;
+}
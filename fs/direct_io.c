@@ -0,0 +1,177 @@
+/*
+ *  'direct_io.c' moves O_DIRECT reads and writes straight between the
+ * disk and the user's memory. It builds buffer heads of its own whose
+ * b_data points into the user's pages, and hands them to ll_rw_blocks(),
+ * which sends runs of consecutive blocks to the driver as one request.
+ * The buffer cache is only looked at, so that it stays coherent: blocks
+ * it already has are read from it, and written into it as well as to the
+ * disk. Nothing new is cached.
+ *
+ * Only whole, aligned blocks go this way - the caller does the rest (the
+ * start of an unaligned request, or the tail of a file) through the cache.
+ */
+
+#include <errno.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <asm/segment.h>
+#include <asm/system.h>
+#include <sys/stat.h>
+
+#define NR_RAW NR_BATCH
+
+static struct buffer_head raw_bh[NR_RAW];
+static struct buffer_head * raw_bhs[NR_RAW];
+static int raw_lock = 0;
+static struct task_struct * raw_wait = NULL;
+
+static inline void lock_raw(void)
+{
+	cli();
+	while (raw_lock)
+		sleep_on(&raw_wait);
+	raw_lock = 1;
+	sti();
+}
+
+static inline void unlock_raw(void)
+{
+	raw_lock = 0;
+	wake_up(&raw_wait);
+}
+
+/*
+ * prepare_pages() makes sure the user's pages are there (and writable,
+ * for reads), as the driver can't take page faults for us.
+ */
+static void prepare_pages(int rw, char * buf, int count)
+{
+	char * end = buf + count;
+	char c;
+
+	buf = (char *) ((unsigned long) buf & ~(PAGE_SIZE-1));
+	for ( ; buf < end ; buf += PAGE_SIZE) {
+		c = get_fs_byte(buf);
+		if (rw == READ)
+			put_fs_byte(c,buf);
+	}
+}
+
+/*
+ * direct_rw() does at most NR_RAW blocks starting at file block 'block'
+ * (or device block, if inode is NULL). It returns the number of blocks
+ * done, which is less than nr if there was an error, and sets *nospc if
+ * that was because no block could be allocated.
+ */
+static int direct_rw(int rw, struct m_inode * inode, int dev, int block,
+	char * buf, int nr, int * nospc)
+{
+	struct buffer_head * bh, * cached;
+	int i, n, size = blocksize(dev);
+	char * addr = (char *) (get_base(current->ldt[2]) + (unsigned long) buf);
+
+	for (i=0 ; i<nr ; i++, buf += size, addr += size) {
+		raw_bhs[i] = NULL;
+		if (!inode)
+			n = block+i;
+		else if (rw == READ)
+			n = bmap(inode,block+i);
+		else
+			n = create_block(inode,block+i);
+		if (inode && !n) {	/* a hole, or a full disk */
+			if (rw == WRITE) {
+				*nospc = 1;
+				break;
+			}
+			for (n=0 ; n<size ; n++)
+				put_fs_byte(0,buf+n);
+			continue;
+		}
+		if (cached = get_hash_table(dev,n)) {
+			if (rw == WRITE) {
+				for (n=0 ; n<size ; n++)
+					cached->b_data[n] = get_fs_byte(buf+n);
+				cached->b_uptodate = 1;
+			} else if (cached->b_uptodate) {
+				for (n=0 ; n<size ; n++)
+					put_fs_byte(cached->b_data[n],buf+n);
+				brelse(cached);
+				continue;
+			}
+			brelse(cached);
+		}
+		bh = raw_bh+i;
+		bh->b_data = addr;
+		bh->b_size = size;
+		bh->b_dev = dev;
+		bh->b_blocknr = n;
+		bh->b_uptodate = 0;
+		bh->b_dirt = (rw == WRITE);
+		bh->b_count = 1;
+		bh->b_lock = 0;
+		bh->b_wait = NULL;
+		bh->b_reqnext = NULL;
+		bh->b_end_io = NULL;
+		raw_bhs[i] = bh;
+	}
+	nr = i;
+	ll_rw_blocks(rw,nr,raw_bhs);
+	for (i=0 ; i<nr ; i++) {
+		if (!(bh = raw_bhs[i]))
+			continue;
+		bh->b_count = 0;
+		if (!bh->b_uptodate)
+			return i;
+	}
+	return nr;
+}
+
+/*
+ * direct_io() is called by block_read(), block_write(), file_read() and
+ * file_write() for O_DIRECT files. It does the part of the request that
+ * is whole blocks at an aligned position, updates *pos, and returns the
+ * number of bytes done, or -ENOSPC or -EIO if there was an error before
+ * any. The disk moves whole sectors to and from buf, so it has to be
+ * sector-aligned, or it is -EINVAL.
+ */
+int direct_io(int rw, struct m_inode * inode, int dev, off_t * pos,
+	char * buf, int count)
+{
+	int size = blocksize(dev);
+	int block, nr, done, i, total = 0, nospc = 0;
+
+	if (*pos % size || (count -= count % size) <= 0)
+		return 0;
+	if ((unsigned long) buf & 511)
+		return -EINVAL;
+	prepare_pages(rw,buf,count);
+	lock_raw();
+	block = *pos / size;
+	while (count > 0) {
+		nr = count / size;
+		if (nr > NR_RAW)
+			nr = NR_RAW;
+		done = direct_rw(rw,inode,dev,block,buf,nr,&nospc);
+		if (inode && rw == WRITE)
+			for (i=0 ; i<done ; i++)
+				update_page(inode,*pos+i*size,
+					raw_bh[i].b_data,size);
+		block += done;
+		buf += done * size;
+		count -= done * size;
+		total += done * size;
+		*pos += done * size;
+		if (inode && rw == WRITE && *pos > inode->i_size) {
+			inode->i_size = *pos;
+			inode->i_dirt = 1;
+		}
+		if (done < nr)
+			break;
+	}
+	unlock_raw();
+	if (total)
+		return total;
+	return nospc?-ENOSPC:-EIO;
+}
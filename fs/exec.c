@@ -18,6 +18,9 @@ extern int sys_close(int fd);
  */
 #define MAX_ARG_PAGES 32
 
+/* zone numbers in an indirect block: executables are on 1kB file systems */
+#define ZONES ZONES_PER_BLOCK(BLOCK_SIZE)
+
 /*
  * Copy a block of data to user space
  * In 64-bit mode, we don't use segment overrides the same way.
@@ -36,50 +39,60 @@ static inline void cp_block(const char *from, unsigned long to)
  */
 int read_head(struct m_inode * inode,int blocks)
 {
-	struct buffer_head * bh;
-	int count;
+	struct buffer_head * bh[6];
+	int nr[6];
+	int count,error=0;
 
 	if (blocks>6)
 		blocks=6;
-	for(count = 0 ; count<blocks ; count++) {
-		if (!inode->i_zone[count+1])
-			continue;
-		if (!(bh=bread(inode->i_dev,inode->i_zone[count+1])))
-			return -1;
-		cp_block(bh->b_data,count*BLOCK_SIZE);
-		brelse(bh);
-	}
-	return 0;
+	for(count = 0 ; count<blocks ; count++)
+		nr[count] = inode->i_zone[count+1];
+	bread_array(inode->i_dev,blocks,nr,bh);
+	for(count = 0 ; count<blocks ; count++)
+		if (bh[count]) {
+			cp_block(bh[count]->b_data,count*BLOCK_SIZE);
+			brelse(bh[count]);
+		} else if (nr[count])
+			error = -1;
+	return error;
 }
 
+/*
+ * read_ind() reads the blocks of an indirect block NR_BATCH at a time,
+ * so the disk isn't waited for once per block.
+ */
 int read_ind(int dev,int ind,long size,unsigned long offset)
 {
-	struct buffer_head * ih, * bh;
-	unsigned short * table,block;
+	struct buffer_head * ih, * bh[NR_BATCH];
+	unsigned int * table;
+	int nr[NR_BATCH];
+	int i,n,error=0;
 
 	if (size<=0)
 		panic("size<=0 in read_ind");
-	if (size>512*BLOCK_SIZE)
-		size=512*BLOCK_SIZE;
+	if (size>ZONES*BLOCK_SIZE)
+		size=ZONES*BLOCK_SIZE;
 	if (!ind)
 		return 0;
 	if (!(ih=bread(dev,ind)))
 		return -1;
-	table = (unsigned short *) ih->b_data;
-	while (size>0) {
-		if (block=*(table++))
-			if (!(bh=bread(dev,block))) {
-				brelse(ih);
-				return -1;
-			} else {
-				cp_block(bh->b_data,offset);
-				brelse(bh);
-			}
-		size -= BLOCK_SIZE;
-		offset += BLOCK_SIZE;
+	table = (unsigned int *) ih->b_data;
+	while (size>0 && !error) {
+		for (n=0 ; n<NR_BATCH && size-n*BLOCK_SIZE>0 ; n++)
+			nr[n] = *(table++);
+		bread_array(dev,n,nr,bh);
+		for (i=0 ; i<n ; i++) {
+			if (bh[i]) {
+				cp_block(bh[i]->b_data,offset);
+				brelse(bh[i]);
+			} else if (nr[i])
+				error = -1;
+			size -= BLOCK_SIZE;
+			offset += BLOCK_SIZE;
+		}
 	}
 	brelse(ih);
-	return 0;
+	return error;
 }
 
 /*
@@ -88,24 +101,27 @@ int read_ind(int dev,int ind,long size,unsigned long offset)
 int read_area(struct m_inode * inode,long size)
 {
 	struct buffer_head * dind;
-	unsigned short * table;
+	unsigned int * table;
 	int i,count;
 
 	if ((i=read_head(inode,(size+BLOCK_SIZE-1)/BLOCK_SIZE)) ||
 	    (size -= BLOCK_SIZE*6)<=0)
 		return i;
 	if ((i=read_ind(inode->i_dev,inode->i_zone[7],size,BLOCK_SIZE*6)) ||
-	    (size -= BLOCK_SIZE*512)<=0)
+	    (size -= BLOCK_SIZE*ZONES)<=0)
 		return i;
 	if (!(i=inode->i_zone[8]))
 		return 0;
 	if (!(dind = bread(inode->i_dev,i)))
 		return -1;
-	table = (unsigned short *) dind->b_data;
-	for(count=0 ; count<512 ; count++)
+	table = (unsigned int *) dind->b_data;
+	for(count=0 ; count<ZONES ; count++)
 		if ((i=read_ind(inode->i_dev,*(table++),size,
-		    BLOCK_SIZE*(518+count))) || (size -= BLOCK_SIZE*512)<=0)
+		    BLOCK_SIZE*(6+ZONES*(count+1)))) ||
+		    (size -= BLOCK_SIZE*ZONES)<=0) {
+			brelse(dind);
 			return i;
+		}
 	panic("Impossibly long executable");
 }
 
@@ -252,6 +268,15 @@ int do_execve(unsigned long * eip,long tmp,char * filename,
 		iput(inode);
 		return -ENOEXEC;
 	}
+/*
+ * ZMAGIC executables have their text at BLOCK_SIZE in the file, and
+ * read_area() copies them a block at a time: only 1kB file systems
+ * will do.
+ */
+	if (blocksize(inode->i_dev) != BLOCK_SIZE) {
+		iput(inode);
+		return -ENOEXEC;
+	}
 	if (!(bh = bread(inode->i_dev,inode->i_zone[0]))) {
 		iput(inode);
 		return -EACCES;
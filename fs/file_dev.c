@@ -3,6 +3,7 @@
 
 #include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <asm/segment.h>
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
@@ -10,19 +11,43 @@
 
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
-	int left,chars,nr;
+	int left,chars,nr,size;
 	struct buffer_head * bh;
+	struct cached_page * page;
 
 	if ((left=count)<=0)
 		return 0;
+	size = blocksize(inode->i_dev);
+	if (filp->f_flags & O_DIRECT) {
+		if ((chars = direct_io(READ,inode,inode->i_dev,&filp->f_pos,
+		    buf,count)) < 0)
+			return chars;
+		buf += chars;
+		left -= chars;
+	}
 	while (left) {
-		if (nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE)) {
+		if (page = find_page(inode,filp,(filp->f_pos)/PAGE_SIZE)) {
+			char * p;
+
+			nr = filp->f_pos % PAGE_SIZE;
+			chars = MIN( PAGE_SIZE-nr , left );
+			filp->f_pos += chars;
+			left -= chars;
+			p = nr + page_address(page);
+			while (chars-->0)
+				put_fs_byte(*(p++),buf++);
+			release_page(page);
+			continue;
+		}
+		if (nr = bmap(inode,(filp->f_pos)/size)) {
 			if (!(bh=bread(inode->i_dev,nr)))
 				break;
+			readahead(filp,inode,inode->i_dev,
+				(filp->f_pos)/size);
 		} else
 			bh = NULL;
-		nr = filp->f_pos % BLOCK_SIZE;
-		chars = MIN( BLOCK_SIZE-nr , left );
+		nr = filp->f_pos % size;
+		chars = MIN( size-nr , left );
 		filp->f_pos += chars;
 		left -= chars;
 		if (bh) {
@@ -42,7 +67,7 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 int file_write(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
 	off_t pos;
-	int block,c;
+	int block,c,size;
 	struct buffer_head * bh;
 	char * p;
 	int i=0;
@@ -55,25 +80,33 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 		pos = inode->i_size;
 	else
 		pos = filp->f_pos;
+	size = blocksize(inode->i_dev);
+	if (filp->f_flags & O_DIRECT) {
+		if ((i = direct_io(WRITE,inode,inode->i_dev,&pos,buf,count)) < 0)
+			return i;
+		buf += i;
+	}
 	while (i<count) {
-		if (!(block = create_block(inode,pos/BLOCK_SIZE)))
+		if (!(block = create_block(inode,pos/size)))
 			break;
 		if (!(bh=bread(inode->i_dev,block)))
 			break;
-		c = pos % BLOCK_SIZE;
+		c = pos % size;
 		p = c + bh->b_data;
-		bh->b_dirt = 1;
-		c = BLOCK_SIZE-c;
+		mark_buffer_dirty(bh);
+		c = size-c;
 		if (c > count-i) c = count-i;
+		for (block=0 ; block<c ; block++)
+			p[block] = get_fs_byte(buf++);
 		pos += c;
 		if (pos > inode->i_size) {
 			inode->i_size = pos;
 			inode->i_dirt = 1;
 		}
 		i += c;
-		while (c-->0)
-			*(p++) = get_fs_byte(buf++);
+		update_page(inode,pos-c,p,c);
 		brelse(bh);
+		balance_dirty(inode->i_dev);
 	}
 	inode->i_mtime = CURRENT_TIME;
 	if (!(filp->f_flags & O_APPEND)) {
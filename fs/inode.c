@@ -49,11 +49,11 @@ void sync_inodes(void)
 static int _bmap(struct m_inode * inode,int block,int create)
 {
 	struct buffer_head * bh;
-	int i;
+	int i,per = ZONES_PER_BLOCK(blocksize(inode->i_dev));
 
 	if (block<0)
 		panic("_bmap: block<0");
-	if (block >= 7+512+512*512)
+	if (block >= 7+per+per*per)
 		panic("_bmap: block>big");
 	if (block<7) {
 		if (create && !inode->i_zone[block])
@@ -64,7 +64,7 @@ static int _bmap(struct m_inode * inode,int block,int create)
 		return inode->i_zone[block];
 	}
 	block -= 7;
-	if (block<512) {
+	if (block<per) {
 		if (create && !inode->i_zone[7])
 			if (inode->i_zone[7]=new_block(inode->i_dev)) {
 				inode->i_dirt=1;
@@ -74,16 +74,16 @@ static int _bmap(struct m_inode * inode,int block,int create)
 			return 0;
 		if (!(bh = bread(inode->i_dev,inode->i_zone[7])))
 			return 0;
-		i = ((unsigned short *) (bh->b_data))[block];
+		i = ((unsigned int *) (bh->b_data))[block];
 		if (create && !i)
 			if (i=new_block(inode->i_dev)) {
-				((unsigned short *) (bh->b_data))[block]=i;
-				bh->b_dirt=1;
+				((unsigned int *) (bh->b_data))[block]=i;
+				mark_buffer_dirty(bh);
 			}
 		brelse(bh);
 		return i;
 	}
-	block -= 512;
+	block -= per;
 	if (create && !inode->i_zone[8])
 		if (inode->i_zone[8]=new_block(inode->i_dev)) {
 			inode->i_dirt=1;
@@ -93,22 +93,22 @@ static int _bmap(struct m_inode * inode,int block,int create)
 		return 0;
 	if (!(bh=bread(inode->i_dev,inode->i_zone[8])))
 		return 0;
-	i = ((unsigned short *)bh->b_data)[block>>9];
+	i = ((unsigned int *)bh->b_data)[block/per];
 	if (create && !i)
 		if (i=new_block(inode->i_dev)) {
-			((unsigned short *) (bh->b_data))[block>>9]=i;
-			bh->b_dirt=1;
+			((unsigned int *) (bh->b_data))[block/per]=i;
+			mark_buffer_dirty(bh);
 		}
 	brelse(bh);
 	if (!i)
 		return 0;
 	if (!(bh=bread(inode->i_dev,i)))
 		return 0;
-	i = ((unsigned short *)bh->b_data)[block&511];
+	i = ((unsigned int *)bh->b_data)[block%per];
 	if (create && !i)
 		if (i=new_block(inode->i_dev)) {
-			((unsigned short *) (bh->b_data))[block&511]=i;
-			bh->b_dirt=1;
+			((unsigned int *) (bh->b_data))[block%per]=i;
+			mark_buffer_dirty(bh);
 		}
 	brelse(bh);
 	return i;
@@ -255,13 +255,14 @@ static void read_inode(struct m_inode * inode)
 
 	lock_inode(inode);
 	sb=get_super(inode->i_dev);
-	block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks +
-		(inode->i_num-1)/INODES_PER_BLOCK;
+	block = MAP_BLOCK(sb->s_blocksize) + sb->s_imap_blocks +
+		sb->s_zmap_blocks +
+		(inode->i_num-1)/INODES_PER_BLOCK(sb->s_blocksize);
 	if (!(bh=bread(inode->i_dev,block)))
 		panic("unable to read i-node block");
 	*(struct d_inode *)inode =
 		((struct d_inode *)bh->b_data)
-			[(inode->i_num-1)%INODES_PER_BLOCK];
+			[(inode->i_num-1)%INODES_PER_BLOCK(sb->s_blocksize)];
 	brelse(bh);
 	unlock_inode(inode);
 }
@@ -274,14 +275,15 @@ static void write_inode(struct m_inode * inode)
 
 	lock_inode(inode);
 	sb=get_super(inode->i_dev);
-	block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks +
-		(inode->i_num-1)/INODES_PER_BLOCK;
+	block = MAP_BLOCK(sb->s_blocksize) + sb->s_imap_blocks +
+		sb->s_zmap_blocks +
+		(inode->i_num-1)/INODES_PER_BLOCK(sb->s_blocksize);
 	if (!(bh=bread(inode->i_dev,block)))
 		panic("unable to read i-node block");
 	((struct d_inode *)bh->b_data)
-		[(inode->i_num-1)%INODES_PER_BLOCK] =
+		[(inode->i_num-1)%INODES_PER_BLOCK(sb->s_blocksize)] =
 			*(struct d_inode *)inode;
-	bh->b_dirt=1;
+	mark_buffer_dirty(bh);
 	inode->i_dirt=0;
 	brelse(bh);
 	unlock_inode(inode);
@@ -79,7 +79,7 @@ static int match(int len, const char * name, struct dir_entry * de)
 static struct buffer_head * find_entry(struct m_inode * dir,
 	const char * name, int namelen, struct dir_entry ** res_dir)
 {
-	int entries;
+	int entries,per;
 	int block,i;
 	struct buffer_head * bh;
 	struct dir_entry * de;
@@ -92,6 +92,7 @@ static struct buffer_head * find_entry(struct m_inode * dir,
 		namelen = NAME_LEN;
 #endif
 	entries = dir->i_size / (sizeof (struct dir_entry));
+	per = DIR_ENTRIES_PER_BLOCK(blocksize(dir->i_dev));
 	*res_dir = NULL;
 	if (!namelen)
 		return NULL;
@@ -102,12 +103,12 @@ static struct buffer_head * find_entry(struct m_inode * dir,
 	i = 0;
 	de = (struct dir_entry *) bh->b_data;
 	while (i < entries) {
-		if ((char *)de >= BLOCK_SIZE+bh->b_data) {
+		if ((char *)de >= bh->b_size+bh->b_data) {
 			brelse(bh);
 			bh = NULL;
-			if (!(block = bmap(dir,i/DIR_ENTRIES_PER_BLOCK)) ||
+			if (!(block = bmap(dir,i/per)) ||
 			    !(bh = bread(dir->i_dev,block))) {
-				i += DIR_ENTRIES_PER_BLOCK;
+				i += per;
 				continue;
 			}
 			de = (struct dir_entry *) bh->b_data;
@@ -136,11 +137,12 @@ static struct buffer_head * find_entry(struct m_inode * dir,
 static struct buffer_head * add_entry(struct m_inode * dir,
 	const char * name, int namelen, struct dir_entry ** res_dir)
 {
-	int block,i;
+	int block,i,per;
 	struct buffer_head * bh;
 	struct dir_entry * de;
 
 	*res_dir = NULL;
+	per = DIR_ENTRIES_PER_BLOCK(blocksize(dir->i_dev));
 #ifdef NO_TRUNCATE
 	if (namelen > NAME_LEN)
 		return NULL;
@@ -157,14 +159,14 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 	i = 0;
 	de = (struct dir_entry *) bh->b_data;
 	while (1) {
-		if ((char *)de >= BLOCK_SIZE+bh->b_data) {
+		if ((char *)de >= bh->b_size+bh->b_data) {
 			brelse(bh);
 			bh = NULL;
-			block = create_block(dir,i/DIR_ENTRIES_PER_BLOCK);
+			block = create_block(dir,i/per);
 			if (!block)
 				return NULL;
 			if (!(bh = bread(dir->i_dev,block))) {
-				i += DIR_ENTRIES_PER_BLOCK;
+				i += per;
 				continue;
 			}
 			de = (struct dir_entry *) bh->b_data;
@@ -179,7 +181,7 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 			dir->i_mtime = CURRENT_TIME;
 			for (i=0; i < NAME_LEN ; i++)
 				de->name[i]=(i<namelen)?get_fs_byte(name+i):0;
-			bh->b_dirt = 1;
+			mark_buffer_dirty(bh);
 			*res_dir = de;
 			return bh;
 		}
@@ -353,7 +355,7 @@ int open_namei(const char * pathname, int flag, int mode,
 			return -ENOSPC;
 		}
 		de->inode = inode->i_num;
-		bh->b_dirt = 1;
+		mark_buffer_dirty(bh);
 		brelse(bh);
 		iput(dir);
 		*res_inode = inode;
@@ -434,7 +436,7 @@ int sys_mkdir(const char * pathname, int mode)
 	de->inode = dir->i_num;
 	strcpy(de->name,"..");
 	inode->i_nlinks = 2;
-	dir_block->b_dirt = 1;
+	mark_buffer_dirty(dir_block);
 	brelse(dir_block);
 	inode->i_mode = I_DIRECTORY | (mode & 0777 & ~current->umask);
 	inode->i_dirt = 1;
@@ -447,7 +449,7 @@ int sys_mkdir(const char * pathname, int mode)
 		return -ENOSPC;
 	}
 	de->inode = inode->i_num;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	dir->i_nlinks++;
 	dir->i_dirt = 1;
 	iput(dir);
@@ -462,11 +464,12 @@ int sys_mkdir(const char * pathname, int mode)
 static int empty_dir(struct m_inode * inode)
 {
 	int nr,block;
-	int len;
+	int len,per;
 	struct buffer_head * bh;
 	struct dir_entry * de;
 
 	len = inode->i_size / sizeof (struct dir_entry);
+	per = DIR_ENTRIES_PER_BLOCK(blocksize(inode->i_dev));
 	if (len<2 || !inode->i_zone[0] ||
 	    !(bh=bread(inode->i_dev,inode->i_zone[0]))) {
 	    	printk("warning - bad directory on dev %04x\n",inode->i_dev);
@@ -481,11 +484,11 @@ static int empty_dir(struct m_inode * inode)
 	nr = 2;
 	de += 2;
 	while (nr<len) {
-		if ((void *) de >= (void *) (bh->b_data+BLOCK_SIZE)) {
+		if ((void *) de >= (void *) (bh->b_data+bh->b_size)) {
 			brelse(bh);
-			block=bmap(inode,nr/DIR_ENTRIES_PER_BLOCK);
+			block=bmap(inode,nr/per);
 			if (!block) {
-				nr += DIR_ENTRIES_PER_BLOCK;
+				nr += per;
 				continue;
 			}
 			if (!(bh=bread(inode->i_dev,block)))
@@ -555,7 +558,7 @@ int sys_rmdir(const char * name)
 	if (inode->i_nlinks != 2)
 		printk("empty directory has nlink!=2 (%d)",inode->i_nlinks);
 	de->inode = 0;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	brelse(bh);
 	inode->i_nlinks=0;
 	inode->i_dirt=1;
@@ -609,7 +612,7 @@ int sys_unlink(const char * name)
 		inode->i_nlinks=1;
 	}
 	de->inode = 0;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	brelse(bh);
 	inode->i_nlinks--;
 	inode->i_dirt = 1;
@@ -668,7 +671,7 @@ int sys_link(const char * oldname, const char * newname)
 		return -ENOSPC;
 	}
 	de->inode = oldinode->i_num;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	brelse(bh);
 	iput(dir);
 	oldinode->i_nlinks++;
@@ -0,0 +1,320 @@
+/*
+ *  'page_cache.c' keeps the data of regular files in whole pages, indexed
+ * by (device, inode, page number). A read that finds its page here never
+ * has to map blocks or look at indirect blocks: bmap() is only called to
+ * fill a page, and then for all of its blocks at once.
+ *
+ * Writes still go to the buffer cache; file_write() copies what it wrote
+ * into the page as well, if there is one. Pages can't be dirty, so they
+ * can always simply be dropped.
+ */
+
+#include <linux/config.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <asm/system.h>
+#include <sys/stat.h>
+
+static struct cached_page page_heads[NR_PAGE_CACHE];
+static struct cached_page * page_hash[NR_PAGE_HASH];
+static struct cached_page * page_hand = page_heads;
+
+int nr_cached_pages = 0;
+int page_cache_target = 0;
+unsigned long page_hits = 0;
+unsigned long page_misses = 0;
+
+#define _pagehashfn(dev,ino,index) \
+(((((unsigned)(dev) << 16) ^ (unsigned)(ino) ^ \
+	((unsigned)(index) * 0x85EBCA6Bu)) * 0x9E3779B9u) >> 24)
+#define page_hash(dev,ino,index) \
+	page_hash[_pagehashfn(dev,ino,index) & (NR_PAGE_HASH-1)]
+
+static inline void wait_on_page(struct cached_page * p)
+{
+	cli();
+	while (p->p_lock)
+		sleep_on(&p->p_wait);
+	sti();
+}
+
+static inline void insert_into_page_hash(struct cached_page * p)
+{
+	p->p_next = page_hash(p->p_dev,p->p_ino,p->p_index);
+	page_hash(p->p_dev,p->p_ino,p->p_index) = p;
+}
+
+static inline void remove_from_page_hash(struct cached_page * p)
+{
+	struct cached_page ** pp = &page_hash(p->p_dev,p->p_ino,p->p_index);
+
+	for ( ; *pp ; pp = &(*pp)->p_next)
+		if (*pp == p) {
+			*pp = p->p_next;
+			break;
+		}
+	p->p_next = NULL;
+}
+
+static struct cached_page * lookup_page(int dev, int ino, unsigned long index)
+{
+	struct cached_page * p;
+
+	for (p = page_hash(dev,ino,index) ; p ; p = p->p_next)
+		if (p->p_index == index && p->p_ino == ino && p->p_dev == dev)
+			return p;
+	return NULL;
+}
+
+/*
+ * drop_page() takes a page out of the cache. Its memory goes back to
+ * the page allocator, or to the caller if keep is set.
+ */
+static unsigned long drop_page(struct cached_page * p, int keep)
+{
+	unsigned long page = p->p_page;
+
+	remove_from_page_hash(p);
+	p->p_page = 0;
+	p->p_uptodate = 0;
+	nr_cached_pages--;
+	if (!keep) {
+		free_page(page);
+		page = 0;
+	}
+	return page;
+}
+
+/*
+ * forget_page() unhashes a page that no longer matches the file. If it
+ * is in use it is only marked bad, and goes with its last user.
+ */
+static void forget_page(struct cached_page * p)
+{
+	remove_from_page_hash(p);
+	p->p_uptodate = 0;
+	if (!p->p_count && !p->p_lock)
+		drop_page(p,0);
+}
+
+/*
+ * get_page_head() finds a head for a new page, and a page to go with it.
+ * While the cache is below page_cache_target it takes a fresh page, after
+ * that it reuses the page of a victim picked with the CLOCK algorithm, as
+ * getblk() does for buffers. It never sleeps, and returns NULL if every
+ * page is in use.
+ */
+static struct cached_page * get_page_head(void)
+{
+	struct cached_page * p, * free = NULL;
+	unsigned long page = 0;
+	int i;
+
+	for (p = page_heads ; p < page_heads+NR_PAGE_CACHE ; p++)
+		if (!p->p_page) {
+			free = p;
+			break;
+		}
+	if (free && nr_cached_pages < page_cache_target &&
+	    nr_free_pages >= 2*MIN_FREE_PAGES)
+		page = get_free_page();
+	for (i=0 ; !page && i<2*NR_PAGE_CACHE ; i++) {
+		p = page_hand;
+		if (++page_hand >= page_heads+NR_PAGE_CACHE)
+			page_hand = page_heads;
+		if (!p->p_page || p->p_count || p->p_lock)
+			continue;
+		if (p->p_ref) {
+			p->p_ref = 0;
+			continue;
+		}
+		page = drop_page(p,1);
+		free = p;
+	}
+	if (!page || !free)
+		return NULL;
+	free->p_page = page;
+	nr_cached_pages++;
+	return free;
+}
+
+/*
+ * fill_page() reads the blocks of a page all in one go with bread_array(),
+ * and zeroes holes and whatever lies past the end of the file. For the
+ * read-ahead window every block counts as read, so that sequential reads
+ * still look sequential to readahead().
+ */
+static int fill_page(struct cached_page * p, struct m_inode * inode,
+	struct file * filp)
+{
+	struct buffer_head * bh[PAGE_SIZE/BLOCK_SIZE];
+	int nr[PAGE_SIZE/BLOCK_SIZE];
+	int i, n, size = blocksize(inode->i_dev);
+	unsigned long block = p->p_index * (PAGE_SIZE/size);
+	char * from, * to = (char *) p->p_page;
+	int error = 0;
+
+	n = PAGE_SIZE/size;
+	for (i=0 ; i<n ; i++)
+		if ((block+i) * size < inode->i_size)
+			nr[i] = bmap(inode,block+i);
+		else
+			nr[i] = 0;
+	bread_array(inode->i_dev,n,nr,bh);
+	for (i=0 ; i<n ; i++) {
+		if (bh[i]) {
+			from = bh[i]->b_data;
+			for (size=bh[i]->b_size ; size-- > 0 ; )
+				*(to++) = *(from++);
+			brelse(bh[i]);
+			readahead(filp,inode,inode->i_dev,block+i);
+			continue;
+		}
+		if (nr[i])
+			error = -1;
+		for (size=blocksize(inode->i_dev) ; size-- > 0 ; )
+			*(to++) = 0;
+	}
+	return error;
+}
+
+/*
+ * find_page() returns page 'index' of a regular file, reading it in if
+ * need be, with a reference that release_page() gives back. It returns NULL
+ * if there is no page to be had or the page couldn't be read: callers
+ * then go through the buffer cache as if there were no page cache.
+ */
+struct cached_page * find_page(struct m_inode * inode, struct file * filp,
+	unsigned long index)
+{
+	struct cached_page * p;
+
+	if (!S_ISREG(inode->i_mode))
+		return NULL;
+	if (p = lookup_page(inode->i_dev,inode->i_num,index)) {
+		p->p_count++;
+		wait_on_page(p);
+		if (!p->p_uptodate) {
+			release_page(p);
+			return NULL;
+		}
+		page_hits++;
+		p->p_ref = 1;
+		return p;
+	}
+	if (!(p = get_page_head()))
+		return NULL;
+	page_misses++;
+	p->p_dev = inode->i_dev;
+	p->p_ino = inode->i_num;
+	p->p_index = index;
+	p->p_count = 1;
+	p->p_lock = 1;
+	p->p_ref = 0;
+	insert_into_page_hash(p);
+	if (!fill_page(p,inode,filp) &&
+	    lookup_page(inode->i_dev,inode->i_num,index) == p)
+		p->p_uptodate = 1;
+	p->p_lock = 0;
+	wake_up(&p->p_wait);
+	if (!p->p_uptodate) {
+		release_page(p);
+		return NULL;
+	}
+	return p;
+}
+
+/*
+ * release_page() drops a reference. A page that went bad, or was
+ * invalidated while it was in use, goes away with its last user.
+ */
+void release_page(struct cached_page * p)
+{
+	if (!p)
+		return;
+	if (!p->p_count--)
+		panic("release_page: free page");
+	if (!p->p_count && p->p_page && !p->p_uptodate && !p->p_lock)
+		drop_page(p,0);
+}
+
+char * page_address(struct cached_page * p)
+{
+	return (char *) p->p_page;
+}
+
+/*
+ * update_page() is called by file_write() after it has put count bytes
+ * from 'from' at pos in the file, so that a cached page of it doesn't go
+ * stale. The bytes never straddle a page, as no block does.
+ */
+void update_page(struct m_inode * inode, unsigned long pos, char * from,
+	int count)
+{
+	struct cached_page * p;
+	char * to;
+
+	if (!(p = lookup_page(inode->i_dev,inode->i_num,pos/PAGE_SIZE)))
+		return;
+	if (p->p_lock || !p->p_uptodate) {
+		forget_page(p);
+		return;
+	}
+	to = (char *) p->p_page + pos%PAGE_SIZE;
+	while (count-- > 0)
+		*(to++) = *(from++);
+}
+
+/*
+ * invalidate_pages() throws out the pages of an inode when it is
+ * truncated, or those of a whole device (ino 0) when its block size
+ * changes on mount.
+ */
+void invalidate_pages(int dev, int ino)
+{
+	struct cached_page * p;
+
+	for (p = page_heads ; p < page_heads+NR_PAGE_CACHE ; p++) {
+		if (!p->p_page || p->p_dev != dev || (ino && p->p_ino != ino))
+			continue;
+		forget_page(p);
+	}
+}
+
+/*
+ * shrink_page_cache() is called by get_free_page() when memory runs low.
+ * Like shrink_buffers() it may not sleep, and gives back up to nr pages
+ * that nobody is using, least recently hit first.
+ */
+int shrink_page_cache(int nr)
+{
+	struct cached_page * p;
+	int i, freed = 0;
+
+	for (i=0 ; freed<nr && nr_cached_pages && i<2*NR_PAGE_CACHE ; i++) {
+		p = page_hand;
+		if (++page_hand >= page_heads+NR_PAGE_CACHE)
+			page_hand = page_heads;
+		if (!p->p_page || p->p_count || p->p_lock)
+			continue;
+		if (p->p_ref) {
+			p->p_ref = 0;
+			continue;
+		}
+		drop_page(p,0);
+		freed++;
+	}
+	return freed;
+}
+
+/*
+ * page_cache_init() decides how many pages file data may take: like the
+ * buffer cache, 1/PAGE_CACHE_SHARE of the memory found at boot.
+ */
+void page_cache_init(long memory_end)
+{
+	page_cache_target = (memory_end >> 12) / PAGE_CACHE_SHARE;
+	if (page_cache_target > NR_PAGE_CACHE)
+		page_cache_target = NR_PAGE_CACHE;
+}
@@ -9,8 +9,8 @@
 extern int rw_char(int rw,int dev, char * buf, int count);
 extern int read_pipe(struct m_inode * inode, char * buf, int count);
 extern int write_pipe(struct m_inode * inode, char * buf, int count);
-extern int block_read(int dev, off_t * pos, char * buf, int count);
-extern int block_write(int dev, off_t * pos, char * buf, int count);
+extern int block_read(int dev, struct file * filp, char * buf, int count);
+extern int block_write(int dev, struct file * filp, char * buf, int count);
 extern int file_read(struct m_inode * inode, struct file * filp,
 		char * buf, int count);
 extern int file_write(struct m_inode * inode, struct file * filp,
@@ -62,7 +62,7 @@ int sys_read(unsigned int fd,char * buf,int count)
 	if (S_ISCHR(inode->i_mode))
 		return rw_char(READ,inode->i_zone[0],buf,count);
 	if (S_ISBLK(inode->i_mode))
-		return block_read(inode->i_zone[0],&file->f_pos,buf,count);
+		return block_read(inode->i_zone[0],file,buf,count);
 	if (S_ISDIR(inode->i_mode) || S_ISREG(inode->i_mode)) {
 		if (count+file->f_pos > inode->i_size)
 			count = inode->i_size - file->f_pos;
@@ -89,7 +89,7 @@ int sys_write(unsigned int fd,char * buf,int count)
 	if (S_ISCHR(inode->i_mode))
 		return rw_char(WRITE,inode->i_zone[0],buf,count);
 	if (S_ISBLK(inode->i_mode))
-		return block_write(inode->i_zone[0],&file->f_pos,buf,count);
+		return block_write(inode->i_zone[0],file,buf,count);
 	if (S_ISREG(inode->i_mode))
 		return file_write(inode,file,buf,count);
 	printk("(Write)inode->i_mode=%06o\n\r",inode->i_mode);
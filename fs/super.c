@@ -13,11 +13,75 @@ __res; })
 
 struct super_block super_block[NR_SUPER];
 
+/*
+ * read_hot_blocks() starts reading in the blocks that were hot when the
+ * device was last synced, in ascending order, so that a fresh mount
+ * doesn't have to fetch the inode tables and much-used files block by
+ * block again. It is only a hint: the reads are read-ahead, which mount
+ * doesn't wait for, and anything odd in it is ignored.
+ */
+static void read_hot_blocks(struct super_block * sb)
+{
+	struct buffer_head * bh;
+	struct hot_blocks * hot;
+	int block[NR_HOT];
+	int i, n = 0, size = sb->s_blocksize;
+
+	if (!(bh = bread(sb->s_dev,HOT_OFFSET/size)))
+		return;
+	hot = (struct hot_blocks *) (bh->b_data + HOT_OFFSET%size);
+	if (hot->h_magic != HOT_MAGIC || hot->h_nr > NR_HOT) {
+		brelse(bh);
+		return;
+	}
+	for (i=0 ; i<hot->h_nr ; i++)
+		if (hot->h_block[i] && hot->h_block[i] < sb->s_nzones)
+			block[n++] = hot->h_block[i];
+	brelse(bh);
+	breada_array(sb->s_dev,n,block);
+}
+
+/*
+ * save_hot_blocks() is called by sys_sync(). It writes the hottest blocks
+ * of every mounted device into the unused end of its super block (see
+ * fs.h), if they changed since last time.
+ */
+void save_hot_blocks(void)
+{
+	static struct hot_blocks hot;
+	struct super_block * sb;
+	struct buffer_head * bh;
+	char * p, * q;
+	int i, size;
+
+	for (sb = super_block ; sb < super_block+NR_SUPER ; sb++) {
+		if (!sb->s_dev || sb->s_dev == (unsigned short) -1 ||
+		    sb->s_rd_only)
+			continue;
+		hot.h_magic = HOT_MAGIC;
+		hot.h_nr = hot_blocks(sb->s_dev,hot.h_block,NR_HOT);
+		size = sb->s_blocksize;
+		if (!(bh = bread(sb->s_dev,HOT_OFFSET/size)))
+			continue;
+		p = bh->b_data + HOT_OFFSET%size;
+		q = (char *) &hot;
+		for (i=0 ; i<sizeof(hot) && p[i] == q[i] ; i++)
+			/* nothing */ ;
+		if (i < sizeof(hot)) {
+			for ( ; i<sizeof(hot) ; i++)
+				p[i] = q[i];
+			mark_buffer_dirty(bh);
+		}
+		brelse(bh);
+	}
+}
+
 struct super_block * do_mount(int dev)
 {
 	struct super_block * p;
-	struct buffer_head * bh;
-	int i,block;
+	struct buffer_head * bh, * map[I_MAP_SLOTS+Z_MAP_SLOTS];
+	int block[I_MAP_SLOTS+Z_MAP_SLOTS];
+	int i,n;
 
 	for(p = &super_block[0] ; p < &super_block[NR_SUPER] ; p++ )
 		if (!(p->s_dev))
@@ -25,30 +89,39 @@ struct super_block * do_mount(int dev)
 	p->s_dev = -1;		/* mark it in use */
 	if (p >= &super_block[NR_SUPER])
 		return NULL;
-	if (!(bh = bread(dev,1)))
+	invalidate_pages(dev,0);
+	if (set_blocksize(dev,BLOCK_SIZE) || !(bh = bread(dev,1))) {
+		p->s_dev = 0;
 		return NULL;
+	}
 	*p = *((struct super_block *) bh->b_data);
 	brelse(bh);
-	if (p->s_magic != SUPER_MAGIC) {
+	if (p->s_magic != SUPER_MAGIC || p->s_log_block_size > 2 ||
+	    set_blocksize(dev,BLOCK_SIZE << p->s_log_block_size)) {
 		p->s_dev = 0;
 		return NULL;
 	}
+	p->s_blocksize = BLOCK_SIZE << p->s_log_block_size;
 	for (i=0;i<I_MAP_SLOTS;i++)
 		p->s_imap[i] = NULL;
 	for (i=0;i<Z_MAP_SLOTS;i++)
 		p->s_zmap[i] = NULL;
-	block=2;
+	if (p->s_imap_blocks > I_MAP_SLOTS || p->s_zmap_blocks > Z_MAP_SLOTS) {
+		p->s_dev = 0;
+		return NULL;
+	}
+	n = p->s_imap_blocks+p->s_zmap_blocks;
+	for (i=0 ; i<n ; i++)
+		block[i] = MAP_BLOCK(p->s_blocksize)+i;
+	bread_array(dev,n,block,map);
 	for (i=0 ; i < p->s_imap_blocks ; i++)
-		if (p->s_imap[i]=bread(dev,block))
-			block++;
-		else
-			break;
+		p->s_imap[i] = map[i];
 	for (i=0 ; i < p->s_zmap_blocks ; i++)
-		if (p->s_zmap[i]=bread(dev,block))
-			block++;
-		else
+		p->s_zmap[i] = map[p->s_imap_blocks+i];
+	for (i=0 ; i<n ; i++)
+		if (!map[i])
 			break;
-	if (block != 2+p->s_imap_blocks+p->s_zmap_blocks) {
+	if (i<n) {
 		for(i=0;i<I_MAP_SLOTS;i++)
 			brelse(p->s_imap[i]);
 		for(i=0;i<Z_MAP_SLOTS;i++)
@@ -64,12 +137,13 @@ struct super_block * do_mount(int dev)
 	p->s_time = 0;
 	p->s_rd_only = 0;
 	p->s_dirt = 0;
+	read_hot_blocks(p);
 	return p;
 }
 
 void mount_root(void)
 {
-	int i,free;
+	int i,free,bits;
 	struct super_block * p;
 	struct m_inode * mi;
 
@@ -87,16 +161,18 @@ void mount_root(void)
 	p->s_isup = p->s_imount = mi;
 	current->pwd = mi;
 	current->root = mi;
+	bits=BITS_PER_BLOCK(p->s_blocksize);
 	free=0;
 	i=p->s_nzones;
 	while (-- i >= 0)
-		if (!set_bit(i&8191,p->s_zmap[i>>13]->b_data))
+		if (!set_bit(i%bits,p->s_zmap[i/bits]->b_data))
 			free++;
-	printk("%d/%d free blocks\n\r",free,p->s_nzones);
+	printk("%d/%d free blocks (%d bytes)\n\r",free,p->s_nzones,
+		p->s_blocksize);
 	free=0;
 	i=p->s_ninodes+1;
 	while (-- i >= 0)
-		if (!set_bit(i&8191,p->s_imap[i>>13]->b_data))
+		if (!set_bit(i%bits,p->s_imap[i/bits]->b_data))
 			free++;
 	printk("%d/%d free inodes\n\r",free,p->s_ninodes);
 }
@@ -5,14 +5,14 @@
 static void free_ind(int dev,int block)
 {
 	struct buffer_head * bh;
-	unsigned short * p;
+	unsigned int * p;
 	int i;
 
 	if (!block)
 		return;
 	if (bh=bread(dev,block)) {
-		p = (unsigned short *) bh->b_data;
-		for (i=0;i<512;i++,p++)
+		p = (unsigned int *) bh->b_data;
+		for (i=0;i<ZONES_PER_BLOCK(bh->b_size);i++,p++)
 			if (*p)
 				free_block(dev,*p);
 		brelse(bh);
@@ -20,19 +20,31 @@ static void free_ind(int dev,int block)
 	free_block(dev,block);
 }
 
+/*
+ * free_dind() reads the indirect blocks NR_BATCH at a time before
+ * handing them to free_ind(), which then finds them in the cache.
+ */
 static void free_dind(int dev,int block)
 {
-	struct buffer_head * bh;
-	unsigned short * p;
-	int i;
+	struct buffer_head * bh, * ind[NR_BATCH];
+	unsigned int * p;
+	int nr[NR_BATCH];
+	int i,j;
 
 	if (!block)
 		return;
 	if (bh=bread(dev,block)) {
-		p = (unsigned short *) bh->b_data;
-		for (i=0;i<512;i++,p++)
-			if (*p)
-				free_ind(dev,*p);
+		p = (unsigned int *) bh->b_data;
+		for (i=0;i<ZONES_PER_BLOCK(bh->b_size);i+=NR_BATCH) {
+			for (j=0;j<NR_BATCH;j++)
+				nr[j] = p[i+j];
+			bread_array(dev,NR_BATCH,nr,ind);
+			for (j=0;j<NR_BATCH;j++)
+				brelse(ind[j]);
+			for (j=0;j<NR_BATCH;j++)
+				if (nr[j])
+					free_ind(dev,nr[j]);
+		}
 		brelse(bh);
 	}
 	free_block(dev,block);
@@ -44,6 +56,7 @@ void truncate(struct m_inode * inode)
 
 	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode)))
 		return;
+	invalidate_pages(inode->i_dev,inode->i_num);
 	for (i=0;i<7;i++)
 		if (inode->i_zone[i]) {
 			free_block(inode->i_dev,inode->i_zone[i]);
@@ -42,6 +42,15 @@ __asm__ volatile ( \
 #define sti() __asm__ volatile ("sti":::"memory")
 #define cli() __asm__ volatile ("cli":::"memory")
 #define nop() __asm__ volatile ("nop"::)
+#define barrier() __asm__ volatile ("":::"memory")
+
+static inline unsigned long rdtsc(void)
+{
+	unsigned int lo, hi;
+
+	__asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long) hi << 32) | lo;
+}
 
 #define iret() __asm__ volatile ("iretq"::)
 
@@ -0,0 +1,105 @@
+#ifndef _BLKDEV_H
+#define _BLKDEV_H
+
+#include <linux/fs.h>
+
+#define NR_BLK_DEV	7	/* majors, see fs.h */
+#define NR_REQUEST	64	/* requests in the pool, for all queues */
+#define NR_QUEUES	8
+#define QUEUE_DEPTH	32	/* default requests per queue */
+#define READ_EXPIRE	(HZ/2)	/* deadline: reads are due after 0.5s */
+#define WRITE_EXPIRE	(5*HZ)	/* ... and writes after 5s */
+#define POLL_BUDGET	1000000	/* TSC cycles poll_rw_block() spins at most */
+#define NR_LAT		128	/* latency histogram buckets, see ll_rw_blk.c */
+
+/*
+ * A request covers nsector sectors starting at the absolute sector
+ * 'sector', going to or from the b_reqnext chain of buffers at bh. All
+ * three are advanced by the driver as sectors get done, so a request
+ * that has to be retried restarts where it stopped: bh is always the
+ * buffer being worked on, and offset the byte in it that the next sector
+ * goes to.
+ */
+struct request {
+	int cmd;		/* READ or WRITE */
+	int errors;
+	unsigned int sector;
+	int nsector;
+	int offset;
+	struct buffer_head * bh;
+	struct request * next;
+	long expires;			/* jiffies */
+	struct request * fifo_next;	/* for the deadline scheduler */
+	int poll;			/* somebody asked to spin for it */
+};
+
+/*
+ * Every device that can work on a request of its own, independently of
+ * the others, has a queue: for the hd driver that is each drive. The
+ * driver only ever works on q_head, which blk_fetch_request() has marked
+ * q_busy; what order the rest is in, and which of them goes next, is up
+ * to the queue's I/O scheduler.
+ */
+struct request_queue {
+	char * q_name;
+	struct request * q_head;
+	int q_busy;
+	int q_count;		/* requests queued */
+	int q_depth;		/* ... at most */
+	int q_max_sectors;	/* per request */
+	int q_unit;		/* for the driver */
+	void (*q_request_fn)(struct request_queue * q);
+	struct task_struct * q_wait;	/* waiting for the queue to drain */
+	struct iosched * q_sched;
+	struct request * q_fifo[2];	/* deadline: READ and WRITE, oldest first */
+	unsigned int q_last_sector;	/* where the last request ended */
+	unsigned long q_requests;	/* made, merged or not */
+	unsigned long q_back_merges;
+	unsigned long q_front_merges;
+	unsigned long q_expired;	/* sent early, as they were due */
+	int q_poll;			/* poll_rw_block() spins, see there */
+	void (*q_poll_fn)(struct request_queue * q);
+	unsigned long q_poll_done;	/* spins that saw their I/O done */
+	unsigned long q_poll_slept;	/* ... that ran out of budget */
+	unsigned int q_lat[2][NR_LAT];	/* poll_rw_block(): [polled][bucket] */
+};
+
+/*
+ * An I/O scheduler puts new requests into the queue with s_add(), and
+ * picks the one to send next with s_next(). Neither may sleep: they are
+ * called with interrupts off, s_next() from the driver's interrupt.
+ */
+struct iosched {
+	char * s_name;
+	void (*s_add)(struct request_queue * q, struct request * req);
+	struct request * (*s_next)(struct request_queue * q);
+};
+
+/*
+ * Drivers register a map function for their major. It returns the
+ * queue that minor 'dev' belongs to, after making *sector absolute,
+ * or NULL if nsect sectors from there are outside the device.
+ */
+typedef struct request_queue * (*blk_map_fn)(int dev,
+	unsigned int * sector, unsigned int nsect);
+
+extern struct request_queue * blk_queues[NR_QUEUES];
+
+extern void register_blkdev(int major, blk_map_fn map);
+extern void blk_init_queue(struct request_queue * q, char * name, int unit,
+	int max_sectors, void (*request_fn)(struct request_queue * q));
+extern struct request * blk_fetch_request(struct request_queue * q);
+extern void end_request(struct request_queue * q);
+extern struct request_queue * find_queue(char * name);
+extern int set_queue_depth(struct request_queue * q, int depth);
+extern void reset_queue_stats(void);
+extern struct iosched * find_iosched(char * name);
+extern int set_iosched(struct request_queue * q, char * name);
+extern void blk_dev_init(void);
+extern void blk_poll_timer(void);
+extern int blk_polled(struct request * req);
+extern unsigned long blk_latency(struct request_queue * q, int poll,
+	int percent, unsigned long * nr);
+extern void end_buffer_io(struct buffer_head * bh, int uptodate);
+
+#endif
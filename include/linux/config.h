@@ -24,6 +24,22 @@
 #define BUFFER_END 0xA0000
 #endif
 
+/*
+ * Share of the memory found at boot that the buffer cache may grow into
+ * (on top of the buffers below BUFFER_END) before it starts reusing
+ * buffers: 1/BUFFER_SHARE of it.
+ */
+#define BUFFER_SHARE 4
+
+/* The page cache may hold up to 1/PAGE_CACHE_SHARE of it in file data. */
+#define PAGE_CACHE_SHARE 4
+
+/*
+ * I/O scheduler every request queue starts with: "elevator", "deadline"
+ * or "noop". The shell's iosched command changes it per queue.
+ */
+#define IO_SCHED "elevator"
+
 /* Root device at bootup. */
 #if	defined(LINUS_HD)
 #define ROOT_DEV 0x306
@@ -33,21 +49,4 @@
 #error "must define HD"
 #endif
 
-/*
- * HD type. If 2, put 2 structures with a comma. If just 1, put
- * only 1 struct. The structs are { HEAD, SECTOR, TRACKS, WPCOM, LZONE, CTL }
- *
- * NOTE. CTL is supposed to be 0 for drives with less than 8 heads, and
- * 8 if heads >= 8. Don't know why, and I haven't tested it on a drive with
- * more than 8 heads, but that is what the bios-listings seem to imply. I
- * just love not having a manual.
- */
-#if	defined(LASU_HD)
-#define HD_TYPE { 7,35,915,65536,920,0 }
-#elif	defined(LINUS_HD)
-#define HD_TYPE { 5,17,980,300,980,0 },{ 5,17,980,300,980,0 }
-#else
-#error "must define a hard-disk type"
-#endif
-
 #endif
@@ -25,8 +25,9 @@
 
 #define READ 0
 #define WRITE 1
+#define READA 2		/* read-ahead - don't block */
 
-void buffer_init(void);
+void buffer_init(long memory_end);
 
 #define MAJOR(a) (((unsigned)(a))>>8)
 #define MINOR(a) ((a)&0xff)
@@ -34,38 +35,115 @@ void buffer_init(void);
 #define NAME_LEN 14
 
 #define I_MAP_SLOTS 8
-#define Z_MAP_SLOTS 8
+#define Z_MAP_SLOTS 64
 #define SUPER_MAGIC 0x137F
 
 #define NR_OPEN 20
 #define NR_INODE 32
 #define NR_FILE 64
 #define NR_SUPER 8
-#define NR_HASH 307
+#define NR_HASH 16384		/* max, power of two: see buffer.c */
 #define NR_BUFFERS nr_buffers
-#define BLOCK_SIZE 1024
+#define BLOCK_SIZE 1024		/* default and smallest block size */
+#define MAX_BLOCK_SIZE 4096	/* a page */
+#define NR_CLUSTER 8
+#define NR_BATCH 32		/* blocks per ll_rw_blocks() from the fs */
+#define BDFLUSH_AGE (30*HZ)
+#define BDFLUSH_INTERVAL (5*HZ)
+#define BDFLUSH_MAX 64
+#define DIRTY_RATIO 40		/* % of the buffers writers may dirty */
+#define RA_MIN 2		/* read-ahead window, in blocks */
+#define RA_MAX 32
+#define NR_PAGE_CACHE 256	/* page cache heads: see page_cache.c */
+#define NR_PAGE_HASH 256	/* power of two */
 #ifndef NULL
 #define NULL ((void *) 0)
 #endif
 
-#define INODES_PER_BLOCK ((BLOCK_SIZE)/(sizeof (struct d_inode)))
-#define DIR_ENTRIES_PER_BLOCK ((BLOCK_SIZE)/(sizeof (struct dir_entry)))
+#define INODES_PER_BLOCK(size) ((size)/(sizeof (struct d_inode)))
+#define DIR_ENTRIES_PER_BLOCK(size) ((size)/(sizeof (struct dir_entry)))
+#define ZONES_PER_BLOCK(size) ((size)/(sizeof (unsigned int)))
+#define BITS_PER_BLOCK(size) ((size)*8)
+
+/*
+ * The boot block and the super block take the first 2kB of a device,
+ * whatever its block size: the maps start in the first block after.
+ */
+#define MAP_BLOCK(size) ((2*BLOCK_SIZE+(size)-1)/(size))
+
+/*
+ * The second half of the super block's kB holds the blocks of the device
+ * that were hottest at the last sync, for do_mount() to read in again.
+ */
+#define HOT_OFFSET (BLOCK_SIZE+512)
+#define HOT_MAGIC 0x486F74
+#define NR_HOT 126
+
+struct hot_blocks {
+	unsigned int h_magic;
+	unsigned int h_nr;
+	unsigned int h_block[NR_HOT];	/* in ascending order */
+};
 
 typedef char buffer_block[BLOCK_SIZE];
 
 struct buffer_head {
-	char * b_data;			/* pointer to data block (1024 bytes) */
+	char * b_data;			/* pointer to data block (b_size bytes) */
+	unsigned short b_size;		/* block size of b_dev */
 	unsigned short b_dev;		/* device (0 = free) */
-	unsigned short b_blocknr;	/* block number */
+	unsigned int b_blocknr;		/* block number */
 	unsigned char b_uptodate;
 	unsigned char b_dirt;		/* 0-clean,1-dirty */
 	unsigned char b_count;		/* users using this block */
 	unsigned char b_lock;		/* 0 - ok, 1 -locked */
+	unsigned char b_ref;		/* hit since the clock hand passed */
+	unsigned char b_reada;		/* read ahead, not used yet */
+	unsigned short b_hits;		/* hits since it got this block */
+	unsigned char b_poll;		/* a task spins in poll_rw_block() */
+	long b_dirtime;			/* jiffies when it last became dirty */
 	struct task_struct * b_wait;
-	struct buffer_head * b_prev;
-	struct buffer_head * b_next;
 	struct buffer_head * b_prev_free;
 	struct buffer_head * b_next_free;
+	struct buffer_head * b_prev_dirty;
+	struct buffer_head * b_next_dirty;
+	struct buffer_head * b_this_page;	/* ring of buffers sharing a page */
+	struct buffer_head * b_reqnext;	/* next block of the same request */
+	void (*b_end_io)(struct buffer_head * bh, int uptodate);
+	void * b_private;		/* for b_end_io */
+};
+
+/*
+ * Buffer cache statistics, for all devices together and per device
+ * (see fs/buffer.c). Evictions count against the device of the buffer
+ * that is thrown out, everything else against the device asked for.
+ */
+#define NR_BSTAT 8
+
+struct buffer_stats {
+	unsigned short bs_dev;
+	unsigned long bs_hits;		/* get_hash_table() found the block */
+	unsigned long bs_misses;	/* ... or didn't */
+	unsigned long bs_reads;		/* bread() had to go to the disk */
+	unsigned long bs_evict_clean;	/* getblk() reused a clean buffer */
+	unsigned long bs_evict_dirty;	/* ... or wrote a dirty one first */
+	unsigned long bs_evict_cluster;	/* neighbours written along with it */
+	unsigned long bs_waits;		/* getblk() slept on buffer_wait */
+	unsigned long bs_readahead;	/* blocks read ahead */
+	unsigned long bs_ra_hits;	/* ... that were used afterwards */
+	unsigned long bs_throttled;	/* writers made to write back first */
+};
+
+struct cached_page {
+	unsigned long p_page;		/* 0 = head not in use */
+	unsigned long p_index;		/* page number within the file */
+	unsigned short p_dev;
+	unsigned short p_ino;
+	unsigned char p_count;		/* users copying from it */
+	unsigned char p_lock;		/* being read in */
+	unsigned char p_uptodate;
+	unsigned char p_ref;		/* hit since the clock hand passed */
+	struct task_struct * p_wait;
+	struct cached_page * p_next;	/* hash chain */
 };
 
 struct d_inode {
@@ -75,7 +153,7 @@ struct d_inode {
 	unsigned long i_time;
 	unsigned char i_gid;
 	unsigned char i_nlinks;
-	unsigned short i_zone[9];
+	unsigned int i_zone[9];
 };
 
 struct m_inode {
@@ -85,7 +163,7 @@ struct m_inode {
 	unsigned long i_mtime;
 	unsigned char i_gid;
 	unsigned char i_nlinks;
-	unsigned short i_zone[9];
+	unsigned int i_zone[9];
 /* these are in memory also */
 	struct task_struct * i_wait;
 	unsigned long i_atime;
@@ -115,21 +193,26 @@ struct file {
 	unsigned short f_count;
 	struct m_inode * f_inode;
 	off_t f_pos;
+	unsigned long f_ra_next;	/* block expected to be read next */
+	unsigned long f_ra_end;		/* read-ahead started up to here */
+	unsigned short f_ra_win;	/* read-ahead window, in blocks */
 };
 
 struct super_block {
 	unsigned short s_ninodes;
-	unsigned short s_nzones;
+	unsigned int s_nzones;
 	unsigned short s_imap_blocks;
 	unsigned short s_zmap_blocks;
 	unsigned short s_firstdatazone;
 	unsigned short s_log_zone_size;
 	unsigned long s_max_size;
 	unsigned short s_magic;
+	unsigned short s_log_block_size;	/* 1024<<n bytes, 0 in minix */
 /* These are only in memory */
-	struct buffer_head * s_imap[8];
-	struct buffer_head * s_zmap[8];
+	struct buffer_head * s_imap[I_MAP_SLOTS];
+	struct buffer_head * s_zmap[Z_MAP_SLOTS];
 	unsigned short s_dev;
+	unsigned short s_blocksize;
 	struct m_inode * s_isup;
 	struct m_inode * s_imount;
 	unsigned long s_time;
@@ -147,6 +230,15 @@ extern struct file file_table[NR_FILE];
 extern struct super_block super_block[NR_SUPER];
 extern struct buffer_head * start_buffer;
 extern int nr_buffers;
+extern int buffer_pages, buffer_target;
+extern struct buffer_stats buffer_stats[NR_BSTAT+1];
+extern unsigned long hash_lookups, hash_probes;
+extern long bdflush_age, bdflush_interval;
+extern int bdflush_max;
+extern int dirty_ratio, nr_dirty, nr_writeback;
+extern struct task_struct * bdflush_wait;
+extern int nr_cached_pages, page_cache_target;
+extern unsigned long page_hits, page_misses;
 
 extern void truncate(struct m_inode * inode);
 extern void sync_inodes(void);
@@ -162,15 +254,53 @@ extern struct m_inode * get_empty_inode(void);
 extern struct m_inode * get_pipe_inode(void);
 extern struct buffer_head * get_hash_table(int dev, int block);
 extern struct buffer_head * getblk(int dev, int block);
+extern int * blksize_size[];
+extern int blocksize(int dev);
+extern int set_blocksize(int dev, int size);
 extern void ll_rw_block(int rw, struct buffer_head * bh);
+extern void ll_rw_blocks(int rw, int nr, struct buffer_head * bhs[]);
+extern void poll_rw_block(int rw, struct buffer_head * bh);
+extern void submit_bh(int rw, struct buffer_head * bh,
+	void (*end_io)(struct buffer_head * bh, int uptodate), void * private);
+extern void submit_blocks(int rw, int nr, struct buffer_head * bhs[],
+	void (*end_io)(struct buffer_head * bh, int uptodate), void * private);
 extern void brelse(struct buffer_head * buf);
 extern struct buffer_head * bread(int dev,int block);
+extern void bread_array(int dev, int nr, int * blocks,
+	struct buffer_head * bhs[]);
+extern void breada(int dev,int block);
+extern void breada_array(int dev, int nr, int * blocks);
+extern void readahead(struct file * filp, struct m_inode * inode,
+	int dev, int block);
+extern int sync_dev(int dev);
+extern int invalidate_buffers(int dev);
+extern int shrink_buffers(int nr);
+extern int hot_blocks(int dev, unsigned int * blocks, int nr);
+extern int hash_index_stats(int * size, int * used, int * probes);
+extern unsigned long hash_bench(int * nr, int rounds, int miss);
+extern void reset_buffer_stats(void);
+extern void mark_buffer_dirty(struct buffer_head * bh);
+extern void balance_dirty(int dev);
+extern int flush_old_buffers(void);
+extern void bdflush(void);
+extern struct cached_page * find_page(struct m_inode * inode,
+	struct file * filp, unsigned long index);
+extern void release_page(struct cached_page * p);
+extern char * page_address(struct cached_page * p);
+extern void update_page(struct m_inode * inode, unsigned long pos,
+	char * from, int count);
+extern void invalidate_pages(int dev, int ino);
+extern int shrink_page_cache(int nr);
+extern int direct_io(int rw, struct m_inode * inode, int dev, off_t * pos,
+	char * buf, int count);
+extern void page_cache_init(long memory_end);
 extern int new_block(int dev);
 extern void free_block(int dev, int block);
 extern struct m_inode * new_inode(int dev);
 extern void free_inode(struct m_inode * inode);
 
 extern void mount_root(void);
+extern void save_hot_blocks(void);
 
 static inline struct super_block * get_super(int dev)
 {
@@ -6,53 +6,20 @@
 #ifndef _HDREG_H
 #define _HDREG_H
 
-/* currently supports only 1 hd, put type here */
-#define HARD_DISK_TYPE 17
-
-/*
- * Ok, hard-disk-type is currently hardcoded. Not beatiful,
- * but easier. We don't use BIOS for anything else, why should
- * we get HD-type from it? Get these values from Reference Guide.
- */
-
-#if HARD_DISK_TYPE == 17
-#define _CYL	977
-#define _HEAD	5
-#define __WPCOM	300
-#define _LZONE	977
-#define _SECT	17
-#define _CTL	0
-#elif HARD_DISK_TYPE == 18
-#define _CYL	977
-#define _HEAD	7
-#define __WPCOM	(-1)
-#define _LZONE	977
-#define _SECT	17
-#define _CTL	0
-#else
-#error Define HARD_DISK_TYPE and parameters, add your own entries as well
-#endif
-
-/* Controller wants just wp-com/4 */
-#if __WPCOM >= 0
-#define _WPCOM ((__WPCOM)>>2)
-#else
-#define _WPCOM __WPCOM
-#endif
-
 /* Hd controller regs. Ref: IBM AT Bios-listing */
 #define HD_DATA		0x1f0	/* _CTL when writing */
 #define HD_ERROR	0x1f1	/* see err-bits */
 #define HD_NSECTOR	0x1f2	/* nr of sectors to read/write */
-#define HD_SECTOR	0x1f3	/* starting sector */
-#define HD_LCYL		0x1f4	/* starting cylinder */
-#define HD_HCYL		0x1f5	/* high byte of starting cyl */
-#define HD_CURRENT	0x1f6	/* 101dhhhh , d=drive, hhhh=head */
+#define HD_SECTOR	0x1f3	/* LBA bits 0-7 (24-31 for LBA48) */
+#define HD_LCYL		0x1f4	/* LBA bits 8-15 (32-39) */
+#define HD_HCYL		0x1f5	/* LBA bits 16-23 (40-47) */
+#define HD_CURRENT	0x1f6	/* 111dxxxx, d=drive, xxxx=LBA28 bits 24-27 */
 #define HD_STATUS	0x1f7	/* see status-bits */
 #define HD_PRECOMP HD_ERROR	/* same io address, read=error, write=precomp */
 #define HD_COMMAND HD_STATUS	/* same io address, read=status, write=cmd */
 
 #define HD_CMD		0x3f6
+#define HD_ALTSTATUS HD_CMD	/* read=status, without ending the interrupt */
 
 /* Bits of HD_STATUS */
 #define ERR_STAT	0x01
@@ -74,6 +41,37 @@
 #define WIN_SEEK 		0x70
 #define WIN_DIAGNOSE		0x90
 #define WIN_SPECIFY		0x91
+#define WIN_MULTREAD		0xC4	/* read/write a block of sectors per */
+#define WIN_MULTWRITE		0xC5	/* interrupt, see WIN_SETMULT */
+#define WIN_SETMULT		0xC6
+#define WIN_IDENTIFY		0xEC
+#define WIN_READ_EXT		0x24	/* LBA48 versions of the above */
+#define WIN_WRITE_EXT		0x34
+#define WIN_MULTREAD_EXT	0x29
+#define WIN_MULTWRITE_EXT	0x39
+#define WIN_READDMA		0xC8
+#define WIN_WRITEDMA		0xCA
+#define WIN_READDMA_EXT		0x25
+#define WIN_WRITEDMA_EXT	0x35
+
+/* Bits of HD_CMD */
+#define CTL_NIEN		0x02	/* no interrupts: we poll */
+
+/*
+ * Bus-master IDE (SFF-8038i, as in the PIIX): registers of the primary
+ * channel, at the I/O base in BAR4 of the controller.
+ */
+#define BM_COMMAND	0	/* start/stop, direction */
+#define BM_STATUS	2
+#define BM_PRD		4	/* physical address of the PRD table */
+
+#define BM_START	0x01
+#define BM_TOMEM	0x08	/* the disk is read, memory written */
+#define BM_STAT_ACTIVE	0x01
+#define BM_STAT_ERR	0x02
+#define BM_STAT_INTR	0x04	/* write 1 to clear, as ERR */
+
+#define PRD_EOT		0x80000000	/* last entry of the table */
 
 /* Bits for HD_ERROR */
 #define MARK_ERR	0x01	/* Bad address mark ? */
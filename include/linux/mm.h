@@ -3,8 +3,15 @@
 
 #define PAGE_SIZE 4096
 
+/* below this many free pages, get_free_page() takes pages from the cache */
+#define MIN_FREE_PAGES 32
+
+extern long nr_free_pages;
+
 extern unsigned long get_free_page(void);
 extern unsigned long put_page(unsigned long page,unsigned long address);
 extern void free_page(unsigned long addr);
+extern unsigned long virt_to_phys(unsigned long addr);
+extern void mem_init(unsigned long end_mem);
 
 #endif
@@ -29,6 +29,7 @@ extern int copy_page_tables(unsigned long from, unsigned long to, long size);
 extern int free_page_tables(unsigned long from, long size);
 
 extern void sched_init(void);
+extern int kernel_thread(void (*fn)(void));
 extern void schedule(void);
 extern void trap_init(void);
 extern void panic(const char * str);
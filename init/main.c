@@ -22,6 +22,8 @@ static inline _syscall0(int,sync)
 #include <linux/tty.h>
 #include <linux/sched.h>
 #include <linux/head.h>
+#include <linux/config.h>
+#include <linux/blkdev.h>
 #include <asm/system.h>
 #include <asm/io.h>
 
@@ -70,6 +72,8 @@ extern void hd_init(void);
 extern long kernel_mktime(struct tm * tm);
 extern long startup_time;
 
+static long memory_end = 0;
+
 /*
  * Yeah, yeah, it's ugly, but I cannot find how to do this correctly
  * and this seems to work. I anybody has more info on the real-time
@@ -114,11 +118,22 @@ void main(void)		/* This really IS void, no error here. */
 	early_serial_init();
 	early_serial_puts("Linux 0.01 (64-bit) starting...\n");
 	time_init();
+/*
+ * Extended memory size (in kB) is in cmos 0x30/0x31. We can't use more
+ * than HIGH_MEMORY, as that is all mem_map and the page tables cover.
+ */
+	memory_end = (1<<20) + (CMOS_READ(0x31)<<18) + (CMOS_READ(0x30)<<10);
+	if (memory_end > HIGH_MEMORY)
+		memory_end = HIGH_MEMORY;
 	tty_init();
 	trap_init();
 	sched_init();
-	buffer_init();
+	mem_init(memory_end);
+	buffer_init(memory_end);
+	page_cache_init(memory_end);
+	blk_dev_init();
 	hd_init();
+	kernel_thread(bdflush);
 	sti();
 	early_serial_puts("Initialization complete.\n");
 	
@@ -160,6 +175,16 @@ static void shell_puts(const char *s)
 	early_serial_puts(s);
 }
 
+static void shell_printf(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vsprintf(printbuf, fmt, args);
+	va_end(args);
+	shell_puts(printbuf);
+}
+
 static int serial_data_ready(void)
 {
 	return inb(SERIAL_PORT + 5) & 0x01;
@@ -200,6 +225,13 @@ static void cmd_help(void)
 	shell_puts("  ps       - show processes\n");
 	shell_puts("  free     - show memory info\n");
 	shell_puts("  uptime   - show uptime\n");
+	shell_puts("  bcstat   - show buffer cache stats (-r resets)\n");
+	shell_puts("  blkstat  - show block queue stats (-r resets)\n");
+	shell_puts("  qdepth   - set queue depth: qdepth <queue> <n>\n");
+	shell_puts("  iosched  - set I/O scheduler: iosched <queue> <name>\n");
+	shell_puts("  iopoll   - poll for reads: iopoll <queue> on|off\n");
+	shell_puts("  iolat    - show read latency p50/p99 (blkstat -r resets)\n");
+	shell_puts("  hbench   - time buffer lookups\n");
 	shell_puts("  reboot   - reboot system\n");
 }
 
@@ -269,6 +301,232 @@ static void cmd_uptime(void)
 	shell_puts(buf);
 }
 
+static void print_bstat(struct buffer_stats *s)
+{
+	if (s->bs_dev)
+		shell_printf("%04x  ", s->bs_dev);
+	else
+		shell_puts("total ");
+	shell_printf(" %7lu %7lu %7lu %7lu %7lu %7lu %5lu %7lu %7lu %5lu\n",
+		s->bs_hits, s->bs_misses, s->bs_reads, s->bs_evict_clean,
+		s->bs_evict_dirty, s->bs_evict_cluster, s->bs_waits,
+		s->bs_readahead, s->bs_ra_hits, s->bs_throttled);
+}
+
+static void cmd_bcstat(void)
+{
+	int i, size, used, probes, max;
+
+	shell_printf("%-6s %7s %7s %7s %7s %7s %7s %5s %7s %7s %5s\n", "dev",
+		"hits", "misses", "reads", "clean", "dirty", "cluster",
+		"waits", "ra", "ra-hit", "thrtl");
+	print_bstat(buffer_stats);
+	for (i = 1; i <= NR_BSTAT; i++)
+		if (buffer_stats[i].bs_dev)
+			print_bstat(buffer_stats + i);
+	shell_printf("buffers: %d (%d pages, target %d), %d dirty, "
+		"%d in writeback\n", nr_buffers, buffer_pages, buffer_target,
+		nr_dirty, nr_writeback);
+	max = hash_index_stats(&size, &used, &probes);
+	shell_printf("hash: %d slots, %d used, longest probe %d",
+		size, used, max);
+	if (used)
+		shell_printf(", average %d.%02d", probes / used,
+			probes * 100 / used % 100);
+	if (hash_lookups)
+		shell_printf(", %d.%02d probes/lookup",
+			(int) (hash_probes / hash_lookups),
+			(int) (hash_probes * 100 / hash_lookups % 100));
+	shell_puts("\n");
+	shell_printf("pages: %d (target %d), %d hits, %d misses\n",
+		nr_cached_pages, page_cache_target,
+		(int) page_hits, (int) page_misses);
+}
+
+static void cmd_blkstat(void)
+{
+	struct request_queue *q;
+	int i;
+
+	shell_printf("%-6s %-8s %5s %6s %8s %8s %8s %7s %7s\n", "queue",
+		"sched", "depth", "queued", "requests", "back", "front",
+		"expired", "merged");
+	for (i = 0; i < NR_QUEUES && (q = blk_queues[i]); i++) {
+		shell_printf("%-6s %-8s %5d %6d %8d %8d %8d %7d", q->q_name,
+			q->q_sched->s_name, q->q_depth, q->q_count,
+			(int) q->q_requests, (int) q->q_back_merges,
+			(int) q->q_front_merges, (int) q->q_expired);
+		if (q->q_requests)
+			shell_printf(" %6d%%", (int) ((q->q_back_merges +
+				q->q_front_merges) * 100 / q->q_requests));
+		shell_puts("\n");
+	}
+}
+
+/*
+ * queue_arg() splits "<queue> <rest>" and finds the queue, leaving
+ * *rest pointing at what follows it.
+ */
+static struct request_queue *queue_arg(char *cmd, char *arg, char **rest)
+{
+	struct request_queue *q;
+	char *p = arg;
+
+	while (*p && *p != ' ')
+		p++;
+	if (*p)
+		*p++ = 0;
+	*rest = p;
+	if (!(q = find_queue(arg)))
+		shell_printf("%s: no such queue\n", cmd);
+	return q;
+}
+
+/*
+ * qdepth <queue> <n> sets how many requests a queue may hold.
+ */
+static void cmd_qdepth(char *arg)
+{
+	struct request_queue *q;
+	char *p;
+	int n = 0;
+
+	if (!(q = queue_arg("qdepth", arg, &p)))
+		return;
+	if (*p < '0' || *p > '9') {
+		shell_printf("%s: depth %d\n", q->q_name, q->q_depth);
+		return;
+	}
+	while (*p >= '0' && *p <= '9')
+		n = n * 10 + *p++ - '0';
+	if (*p || set_queue_depth(q, n))
+		shell_printf("qdepth: depth must be 1-%d\n", NR_REQUEST);
+	else
+		shell_printf("%s: depth %d\n", q->q_name, q->q_depth);
+}
+
+/*
+ * iopoll <queue> [on|off] shows or sets whether bread() spins for the
+ * queue's I/O instead of sleeping until the interrupt.
+ */
+static void cmd_iopoll(char *arg)
+{
+	struct request_queue *q;
+	char *p;
+
+	if (!(q = queue_arg("iopoll", arg, &p)))
+		return;
+	if (strcmp(p, "on") == 0)
+		q->q_poll = 1;
+	else if (strcmp(p, "off") == 0)
+		q->q_poll = 0;
+	else if (*p) {
+		shell_puts("iopoll: on or off\n");
+		return;
+	}
+	shell_printf("%s: polling %s\n", q->q_name, q->q_poll ? "on" : "off");
+}
+
+/*
+ * iolat shows the p50 and p99 of bread()'s latency per queue, with and
+ * without polling. The TSC is timed against one tick, so that it can be
+ * given in microseconds.
+ */
+static void print_lat(unsigned long cycles, unsigned long mhz)
+{
+	unsigned long us10 = cycles * 10 / mhz;
+
+	shell_printf(" %7d.%d", (int) (us10 / 10), (int) (us10 % 10));
+}
+
+static void cmd_iolat(void)
+{
+	struct request_queue *q;
+	unsigned long nr, mhz;
+	long t;
+	int i, poll;
+
+	t = jiffies;
+	while (jiffies == t)
+		/* nothing */ ;
+	t = jiffies;
+	mhz = rdtsc();
+	while (jiffies == t)
+		/* nothing */ ;
+	mhz = (rdtsc() - mhz) / (1000000 / HZ);
+	if (!mhz)
+		mhz = 1;
+	shell_printf("%-6s %-4s %8s %9s %9s   (us, TSC %d MHz)\n", "queue",
+		"mode", "reads", "p50", "p99", (int) mhz);
+	for (i = 0; i < NR_QUEUES && (q = blk_queues[i]); i++) {
+		for (poll = 0; poll < 2; poll++) {
+			blk_latency(q, poll, 50, &nr);
+			shell_printf("%-6s %-4s %8d", q->q_name,
+				poll ? "poll" : "irq", (int) nr);
+			if (nr) {
+				print_lat(blk_latency(q, poll, 50, &nr), mhz);
+				print_lat(blk_latency(q, poll, 99, &nr), mhz);
+			}
+			shell_puts("\n");
+		}
+		if (q->q_poll_done || q->q_poll_slept)
+			shell_printf("%-6s %d polls done spinning, %d slept\n",
+				q->q_name, (int) q->q_poll_done,
+				(int) q->q_poll_slept);
+	}
+}
+
+/*
+ * iosched <queue> [elevator|deadline|noop] shows or sets the scheduler.
+ */
+static void cmd_iosched(char *arg)
+{
+	struct request_queue *q;
+	char *p;
+
+	if (!(q = queue_arg("iosched", arg, &p)))
+		return;
+	if (*p && set_iosched(q, p))
+		shell_puts("iosched: elevator, deadline or noop\n");
+	else
+		shell_printf("%s: %s\n", q->q_name, q->q_sched->s_name);
+}
+
+/*
+ * hbench times buffer lookups for growing numbers of distinct cached
+ * blocks, so that it shows when the index stops fitting in the CPU
+ * caches. Every size does about the same number of lookups.
+ */
+static void print_cycles(unsigned long cycles, unsigned long lookups)
+{
+	unsigned long c = cycles * 100 / lookups;
+
+	shell_printf(" %7d.%02d", (int) (c / 100), (int) (c % 100));
+}
+
+static void cmd_hbench(void)
+{
+	static int sizes[] = { 16, 64, 256, 1024, 4096, 16384, 0 };
+	int i, nr, rounds;
+	unsigned long hit, miss;
+
+	shell_printf("%6s %10s %10s\n", "keys", "hit cyc", "miss cyc");
+	for (i = 0; sizes[i]; i++) {
+		nr = sizes[i];
+		rounds = 262144 / nr;
+		hit = hash_bench(&nr, rounds, 0);
+		if (!nr)
+			break;
+		miss = hash_bench(&nr, rounds, 1);
+		shell_printf("%6d", nr);
+		print_cycles(hit, (unsigned long) rounds * nr);
+		print_cycles(miss, (unsigned long) rounds * nr);
+		shell_puts("\n");
+		if (nr < sizes[i])
+			break;
+	}
+}
+
 static void cmd_reboot(void)
 {
 	shell_puts("Rebooting...\n");
@@ -295,6 +553,26 @@ static void process_command(void)
 		cmd_free();
 	} else if (strcmp(cmd_buf, "uptime") == 0) {
 		cmd_uptime();
+	} else if (strcmp(cmd_buf, "bcstat") == 0) {
+		cmd_bcstat();
+	} else if (strcmp(cmd_buf, "bcstat -r") == 0) {
+		reset_buffer_stats();
+		shell_puts("Buffer cache stats reset\n");
+	} else if (strcmp(cmd_buf, "blkstat") == 0) {
+		cmd_blkstat();
+	} else if (strcmp(cmd_buf, "blkstat -r") == 0) {
+		reset_queue_stats();
+		shell_puts("Block queue stats reset\n");
+	} else if (strncmp(cmd_buf, "qdepth ", 7) == 0) {
+		cmd_qdepth(cmd_buf + 7);
+	} else if (strncmp(cmd_buf, "iosched ", 8) == 0) {
+		cmd_iosched(cmd_buf + 8);
+	} else if (strncmp(cmd_buf, "iopoll ", 7) == 0) {
+		cmd_iopoll(cmd_buf + 7);
+	} else if (strcmp(cmd_buf, "iolat") == 0) {
+		cmd_iolat();
+	} else if (strcmp(cmd_buf, "hbench") == 0) {
+		cmd_hbench();
 	} else if (strcmp(cmd_buf, "reboot") == 0) {
 		cmd_reboot();
 	} else {
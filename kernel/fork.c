@@ -18,6 +18,8 @@ extern void ret_from_fork(void);
 
 long last_pid=0;
 
+int find_empty_process(void);
+
 void verify_area(void * addr,int size)
 {
 	unsigned long start;
@@ -187,6 +189,58 @@ int copy_process(int nr, long rbp, long user_rdi, long user_rsi, long gs,
 	return last_pid;
 }
 
+/*
+ * kernel_thread() starts fn() as a new task that runs entirely in kernel
+ * mode. There is no user memory to copy, so all it needs is a task_struct
+ * and a kernel stack whose only content is the address of fn(): the first
+ * __switch_to to the new task simply 'returns' into it. fn() is entered
+ * with interrupts in whatever state schedule() left them, and must never
+ * return.
+ */
+int kernel_thread(void (*fn)(void))
+{
+	struct task_struct *p;
+	unsigned long *kstack;
+	int i,nr;
+
+	if ((nr = find_empty_process()) < 0)
+		return nr;
+	p = (struct task_struct *) get_free_page();
+	if (!p)
+		return -EAGAIN;
+	*p = *current;
+	p->state = TASK_UNINTERRUPTIBLE;
+	p->pid = last_pid;
+	p->father = current->pid;
+	p->counter = p->priority;
+	p->signal = 0;
+	p->alarm = 0;
+	p->leader = 0;
+	p->utime = p->stime = 0;
+	p->cutime = p->cstime = 0;
+	p->start_time = jiffies;
+	p->used_math = 0;
+	p->pwd = p->root = NULL;
+	for (i=0; i<NR_OPEN;i++)
+		p->filp[i] = NULL;
+
+	kstack = (unsigned long *)((unsigned long)p + PAGE_SIZE);
+	*--kstack = 0;			/* fn() doesn't return */
+	*--kstack = (unsigned long)fn;
+	p->thread.rsp = (unsigned long)kstack;
+	p->thread.rbx = 0;
+	p->thread.rbp = 0;
+	p->thread.r12 = 0;
+	p->thread.r13 = 0;
+	p->thread.r14 = 0;
+	p->thread.r15 = 0;
+
+	set_ldt_desc(gdt+(nr<<1)+FIRST_LDT_ENTRY,&(p->ldt));
+	p->state = TASK_RUNNING;
+	task[nr] = p;
+	return last_pid;
+}
+
 int find_empty_process(void)
 {
 	int i;
@@ -3,126 +3,198 @@
 #include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/hdreg.h>
+#include <linux/blkdev.h>
+#include <linux/mm.h>
 #include <asm/system.h>
 #include <asm/io.h>
 #include <asm/segment.h>
 
 /*
- * This code handles all hd-interrupts, and read/write requests to
- * the hard-disk. It is relatively straigthforward (not obvious maybe,
- * but interrupts never are), while still being efficient, and never
- * disabling interrupts (except to overcome possible race-condition).
- * The elevator block-seek algorithm doesn't need to disable interrupts
- * due to clever programming.
+ * This code handles all hd-interrupts, and the read/write requests that
+ * ll_rw_blk.c queues for the hard-disk. It is relatively straigthforward
+ * (not obvious maybe, but interrupts never are). Each drive has a queue
+ * of its own, but as they share the controller only one request is ever
+ * running, and the drives with work take turns.
  */
 
 /* Max read/write errors/sector */
 #define MAX_ERRORS	5
 #define MAX_HD		2
-#define NR_REQUEST	32
+#define MAX_SECTORS	256	/* per command: the count register is 8 bits */
 
 /*
- *  This struct defines the HD's and their types.
- *  Currently defined for CP3044's, ie a modified
- *  type 17.
+ * The drives are found, and their sizes taken, with IDENTIFY at boot:
+ * see hd_setup_drive(). Drives are addressed by LBA only - LBA48 if they
+ * can do it, so that sectors past 2^28 can be reached.
  */
-static struct hd_i_struct{
-	int head,sect,cyl,wpcom,lzone,ctl;
-	} hd_info[]= { HD_TYPE };
-
-#define NR_HD ((sizeof (hd_info))/(sizeof (struct hd_i_struct)))
+static int nr_hd = 0;
+static int hd_lba48[MAX_HD] = {0, };
 
 static struct hd_struct {
 	long start_sect;
 	long nr_sects;
 } hd[5*MAX_HD]={{0,0},};
 
-static struct hd_request {
-	int hd;		/* -1 if no request */
-	int nsector;
-	int sector;
-	int head;
-	int cyl;
-	int cmd;
-	int errors;
-	struct buffer_head * bh;
-	struct hd_request * next;
-} request[NR_REQUEST];
+static int hd_blocksizes[5*MAX_HD] = {0, };
 
-#define IN_ORDER(s1,s2) \
-((s1)->hd<(s2)->hd || (s1)->hd==(s2)->hd && \
-((s1)->cyl<(s2)->cyl || (s1)->cyl==(s2)->cyl && \
-((s1)->head<(s2)->head || (s1)->head==(s2)->head && \
-((s1)->sector<(s2)->sector))))
+/*
+ * Sectors per interrupt, as set with WIN_SETMULT: 1 if the drive can't
+ * do READ/WRITE MULTIPLE. Reset drives forget it, so reset_hd() sets it
+ * again.
+ */
+static int hd_mult[MAX_HD] = {1, 1};
+static int reset_drive;
 
-static struct hd_request * this_request = NULL;
+/* The IDENTIFY data of each drive, or zeroes if it has none. */
+static unsigned short hd_ident[MAX_HD][256];
 
-static int sorting=0;
+/*
+ * Bus-master DMA: bm_base is 0 if no controller was found. There is only
+ * one PRD table, as only this_request is ever active. It takes a page,
+ * so that it can't cross a 64kB boundary.
+ */
+static unsigned short bm_base = 0;
+static unsigned int * prd_table = NULL;
+static int hd_dma[MAX_HD] = {0, };
+
+/* DMA commands, by [lba48][write] */
+static unsigned char hd_dma_cmd[2][2] = {
+	{WIN_READDMA,WIN_WRITEDMA},{WIN_READDMA_EXT,WIN_WRITEDMA_EXT}};
+
+/* read and write commands, by [lba48][multiple][write] */
+static unsigned char hd_cmd[2][2][2] = {
+	{{WIN_READ,WIN_WRITE},{WIN_MULTREAD,WIN_MULTWRITE}},
+	{{WIN_READ_EXT,WIN_WRITE_EXT},{WIN_MULTREAD_EXT,WIN_MULTWRITE_EXT}}};
+
+/*
+ * this_request is the one the controller is working on: the head of
+ * this_queue, and NULL if it is idle. next_drive is whose turn it is.
+ */
+static struct request_queue hd_queue[MAX_HD];
+static char * hd_names[MAX_HD] = {"hd0", "hd1"};
+static struct request_queue * this_queue = NULL;
+static struct request * this_request = NULL;
+static int next_drive = 0;
+
+/*
+ * Set while the command in flight was started with the drive's interrupt
+ * off (CTL_NIEN), for a task in poll_rw_block(): hd_poll_fn() then does
+ * what the interrupt would have, until the task gives up.
+ */
+static int hd_polled = 0;
 
 static void do_request(void);
 static void reset_controller(void);
-static void rw_abs_hd(int rw,unsigned int nr,unsigned int sec,unsigned int head,
-	unsigned int cyl,struct buffer_head * bh);
 void hd_init(void);
 
-/* Port I/O operations for 64-bit */
+/* nr words from/to the data port, with string I/O */
 static inline void port_read(int port, void *buf, int nr)
 {
-	unsigned short *p = (unsigned short *)buf;
-	while (nr--)
-		*p++ = inw(port);
+	__asm__ volatile ("cld;rep;insw"
+		:"+D" (buf),"+c" (nr):"d" (port):"memory");
 }
 
 static inline void port_write(int port, const void *buf, int nr)
 {
-	const unsigned short *p = (const unsigned short *)buf;
-	while (nr--)
-		outw(*p++, port);
+	__asm__ volatile ("cld;rep;outsw"
+		:"+S" (buf),"+c" (nr):"d" (port));
 }
 
 extern void hd_interrupt(void);
 
-static struct task_struct * wait_for_request=NULL;
+/*
+ * end_buffer() finishes the buffer a request is working on and moves
+ * the request on to the next one in the chain.
+ */
+static inline void end_buffer(struct request * req, int uptodate)
+{
+	struct buffer_head * bh = req->bh;
 
-static inline void lock_buffer(struct buffer_head * bh)
+	req->bh = bh->b_reqnext;
+	req->offset = 0;
+	bh->b_reqnext = NULL;
+	end_buffer_io(bh,uptodate);
+}
+
+/*
+ * A drive has 400ns after a command, or a block of data written to it,
+ * before its status has to show it busy: until then it may still show
+ * the status from before. Four reads of the alternate status take at
+ * least that long. Only hd_poll_fn() needs this - an interrupt doesn't
+ * come early.
+ */
+static inline void hd_settle(void)
 {
-	if (bh->b_lock)
-		printk("hd.c: buffer multiply locked\n");
-	bh->b_lock=1;
+	int i;
+
+	for (i=0 ; i<4 ; i++)
+		inb(HD_ALTSTATUS);
 }
 
-static inline void unlock_buffer(struct buffer_head * bh)
+/*
+ * hd_transfer() moves nsect sectors between the data port and the
+ * buffers of a request, starting where the request stands. It leaves the
+ * request alone: that is up to hd_advance(), once the drive says the
+ * sectors are done.
+ */
+static void hd_transfer(struct request * req, int nsect, int rw)
 {
-	if (!bh->b_lock)
-		printk("hd.c: free buffer being unlocked\n");
-	bh->b_lock=0;
-	wake_up(&bh->b_wait);
+	struct buffer_head * bh = req->bh;
+	int offset = req->offset, n;
+
+	while (nsect > 0) {
+		n = (bh->b_size - offset) >> 9;
+		if (n > nsect)
+			n = nsect;
+		if (rw == READ)
+			port_read(HD_DATA,bh->b_data+offset,n<<8);
+		else
+			port_write(HD_DATA,bh->b_data+offset,n<<8);
+		nsect -= n;
+		if ((offset += n<<9) >= bh->b_size) {
+			bh = bh->b_reqnext;
+			offset = 0;
+		}
+	}
+	if (rw == WRITE && hd_polled)
+		hd_settle();
 }
 
-static inline void wait_on_buffer(struct buffer_head * bh)
+static void hd_advance(struct request * req, int nsect)
 {
-	cli();
-	while (bh->b_lock)
-		sleep_on(&bh->b_wait);
-	sti();
+	int n;
+
+	req->sector += nsect;
+	req->nsector -= nsect;
+	while (nsect > 0) {
+		n = (req->bh->b_size - req->offset) >> 9;
+		if (n > nsect)
+			n = nsect;
+		nsect -= n;
+		if ((req->offset += n<<9) >= req->bh->b_size)
+			end_buffer(req,1);
+	}
 }
 
-void rw_hd(int rw, struct buffer_head * bh)
+/* sectors the drive moves per interrupt for the current request */
+static inline int hd_block(struct request * req, int drive)
 {
-	unsigned int block,dev;
-	unsigned int sec,head,cyl;
+	return (req->nsector < hd_mult[drive]) ?
+		req->nsector : hd_mult[drive];
+}
 
-	block = bh->b_blocknr << 1;
-	dev = MINOR(bh->b_dev);
-	if (dev >= 5*NR_HD || block+2 > hd[dev].nr_sects)
-		return;
-	block += hd[dev].start_sect;
-	dev /= 5;
-	__asm__("divl %4":"=a" (block),"=d" (sec):"0" (block),"1" (0),
-		"r" (hd_info[dev].sect));
-	__asm__("divl %4":"=a" (cyl),"=d" (head):"0" (block),"1" (0),
-		"r" (hd_info[dev].head));
-	rw_abs_hd(rw,dev,sec+1,head,cyl,bh);
+/*
+ * hd_map() tells ll_rw_blk.c where sectors of minor dev are: it makes
+ * *sector absolute, and returns the queue of the drive.
+ */
+static struct request_queue * hd_map(int dev, unsigned int * sector,
+	unsigned int nsect)
+{
+	dev = MINOR(dev);
+	if (dev >= 5*nr_hd || *sector+nsect > hd[dev].nr_sects)
+		return NULL;
+	*sector += hd[dev].start_sect;
+	return hd_queue + dev/5;
 }
 
 /* This may be used only once, enforced by 'static int callable' */
@@ -131,29 +203,30 @@ int sys_setup(void)
 	static int callable = 1;
 	int i,drive;
 	struct partition *p;
+	struct buffer_head * bh;
 
 	if (!callable)
 		return -1;
 	callable = 0;
-	for (drive=0 ; drive<NR_HD ; drive++) {
-		rw_abs_hd(READ,drive,1,0,0,(struct buffer_head *) start_buffer);
-		if (!start_buffer->b_uptodate) {
+	for (drive=0 ; drive<nr_hd ; drive++) {
+		if (!(bh = bread(0x300+5*drive,0))) {
 			printk("Unable to read partition table of drive %d\n\r",
 				drive);
 			panic("");
 		}
-		if (start_buffer->b_data[510] != 0x55 || (unsigned char)
-		    start_buffer->b_data[511] != 0xAA) {
+		if (bh->b_data[510] != 0x55 || (unsigned char)
+		    bh->b_data[511] != 0xAA) {
 			printk("Bad partition table on drive %d\n\r",drive);
 			panic("");
 		}
-		p = 0x1BE + (void *)start_buffer->b_data;
+		p = 0x1BE + (void *)bh->b_data;
 		for (i=1;i<5;i++,p++) {
 			hd[i+5*drive].start_sect = p->start_sect;
 			hd[i+5*drive].nr_sects = p->nr_sects;
 		}
+		brelse(bh);
 	}
-	printk("Partition table%s ok.\n\r",(NR_HD>1)?"s":"");
+	printk("Partition table%s ok.\n\r",(nr_hd>1)?"s":"");
 	mount_root();
 	return (0);
 }
@@ -183,26 +256,40 @@ static int win_result(void)
 	return (1);
 }
 
-static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sect,
-		unsigned int head,unsigned int cyl,unsigned int cmd,
-		void (*intr_addr)(void))
+/*
+ * hd_out() starts a command for nsect sectors (256 at most) at the LBA
+ * 'sector'. For LBA48 the high bytes go first, into the same registers:
+ * our sector numbers are 32 bits, so that is only bits 24-31.
+ */
+static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sector,
+		unsigned int cmd,void (*intr_addr)(void))
 {
-	register int port asm("dx");
-
-	if (drive>1 || head>15)
+	if (drive>=nr_hd)
 		panic("Trying to write bad sector");
 	if (!controller_ready())
 		panic("HD controller not ready");
 	do_hd = intr_addr;
-	outb(_CTL,HD_CMD);
-	port=HD_DATA;
-	outb_p(_WPCOM,++port);
-	outb_p(nsect,++port);
-	outb_p(sect,++port);
-	outb_p(cyl,++port);
-	outb_p(cyl>>8,++port);
-	outb_p(0xA0|(drive<<4)|head,++port);
-	outb(cmd,++port);
+	outb(hd_polled?CTL_NIEN:0,HD_CMD);
+	if (hd_lba48[drive]) {
+		outb_p(nsect>>8,HD_NSECTOR);
+		outb_p(sector>>24,HD_SECTOR);
+		outb_p(0,HD_LCYL);
+		outb_p(0,HD_HCYL);
+		outb_p(nsect,HD_NSECTOR);
+		outb_p(sector,HD_SECTOR);
+		outb_p(sector>>8,HD_LCYL);
+		outb_p(sector>>16,HD_HCYL);
+		outb_p(0xE0|(drive<<4),HD_CURRENT);
+	} else {
+		outb_p(nsect,HD_NSECTOR);
+		outb_p(sector,HD_SECTOR);
+		outb_p(sector>>8,HD_LCYL);
+		outb_p(sector>>16,HD_HCYL);
+		outb_p(0xE0|(drive<<4)|((sector>>24)&15),HD_CURRENT);
+	}
+	outb(cmd,HD_COMMAND);
+	if (hd_polled)
+		hd_settle();
 }
 
 static int drive_busy(void)
@@ -234,10 +321,26 @@ static void reset_controller(void)
 		printk("HD-controller reset failed: %02x\n\r",i);
 }
 
+/*
+ * After a reset the drive has to be told its multiple count again. A
+ * drive that was using single sectors may reject even a count of 1,
+ * which doesn't matter.
+ */
+static void setmult_intr(void)
+{
+	if (win_result() && hd_mult[reset_drive] > 1) {
+		printk("hd%d: can't set multiple mode again\n\r",reset_drive);
+		hd_mult[reset_drive] = 1;
+	}
+	do_request();
+}
+
 static void reset_hd(int nr)
 {
 	reset_controller();
-	hd_out(nr,_SECT,_SECT,_HEAD-1,_CYL,WIN_SPECIFY,&do_request);
+	reset_drive = nr;
+	hd_polled = 0;
+	hd_out(nr,hd_mult[nr],0,WIN_SETMULT,&setmult_intr);
 }
 
 void unexpected_hd_interrupt(void)
@@ -247,35 +350,38 @@ void unexpected_hd_interrupt(void)
 
 static void bad_rw_intr(void)
 {
-	int i = this_request->hd;
+	int i = this_queue->q_unit;
 
 	if (this_request->errors++ >= MAX_ERRORS) {
-		this_request->bh->b_uptodate = 0;
-		unlock_buffer(this_request->bh);
-		wake_up(&wait_for_request);
-		this_request->hd = -1;
-		this_request=this_request->next;
+		while (this_request->bh)
+			end_buffer(this_request,0);
+		end_request(this_queue);
+		this_request = NULL;
 	}
 	reset_hd(i);
 }
 
+/*
+ * With READ/WRITE MULTIPLE the drive interrupts once per block of
+ * hd_mult sectors (the last block may be shorter) instead of once per
+ * sector.
+ */
 static void read_intr(void)
 {
+	int n;
+
 	if (win_result()) {
 		bad_rw_intr();
 		return;
 	}
-	port_read(HD_DATA,this_request->bh->b_data+
-		512*(this_request->nsector&1),256);
+	n = hd_block(this_request,this_queue->q_unit);
+	hd_transfer(this_request,n,READ);
 	this_request->errors = 0;
-	if (--this_request->nsector)
+	hd_advance(this_request,n);
+	if (this_request->nsector)
 		return;
-	this_request->bh->b_uptodate = 1;
-	this_request->bh->b_dirt = 0;
-	wake_up(&wait_for_request);
-	unlock_buffer(this_request->bh);
-	this_request->hd = -1;
-	this_request=this_request->next;
+	end_request(this_queue);
+	this_request = NULL;
 	do_request();
 }
 
@@ -285,137 +391,346 @@ static void write_intr(void)
 		bad_rw_intr();
 		return;
 	}
-	if (--this_request->nsector) {
-		port_write(HD_DATA,this_request->bh->b_data+512,256);
+	hd_advance(this_request,hd_block(this_request,this_queue->q_unit));
+	if (this_request->nsector) {
+		hd_transfer(this_request,
+			hd_block(this_request,this_queue->q_unit),WRITE);
 		return;
 	}
-	this_request->bh->b_uptodate = 1;
-	this_request->bh->b_dirt = 0;
-	wake_up(&wait_for_request);
-	unlock_buffer(this_request->bh);
-	this_request->hd = -1;
-	this_request=this_request->next;
+	end_request(this_queue);
+	this_request = NULL;
 	do_request();
 }
 
-static void do_request(void)
+/*
+ * hd_build_prd() describes the rest of a request to the bus master: one
+ * PRD entry per piece of physically contiguous memory that doesn't cross
+ * a 64kB boundary, so a chain of buffers goes in one transfer. It returns
+ * 0 if a buffer can't be reached by DMA, and the request has to use PIO:
+ * that includes odd addresses and lengths, as the bus master ignores
+ * bit 0 of both.
+ */
+static int hd_build_prd(struct request * req)
 {
-	int i,r;
+	struct buffer_head * bh;
+	unsigned int * prd = prd_table, * last = NULL;
+	unsigned long addr, phys;
+	int offset = req->offset, size, len;
+
+	for (bh = req->bh ; bh ; bh = bh->b_reqnext, offset = 0) {
+		addr = (unsigned long) bh->b_data + offset;
+		for (size = bh->b_size - offset ; size > 0 ; size -= len) {
+			len = PAGE_SIZE - (addr & (PAGE_SIZE-1));
+			if (len > size)
+				len = size;
+			if (!(phys = virt_to_phys(addr)) || phys >> 32 ||
+			    ((phys | len) & 1))
+				return 0;
+			addr += len;
+			if (last && last[0] + (last[1] & 0xffff) == phys &&
+			    (last[1] & 0xffff) + len < 0x10000 &&
+			    !((last[0] ^ (phys+len-1)) & ~0xffff)) {
+				last[1] += len;
+				continue;
+			}
+			if (prd >= prd_table + PAGE_SIZE/4)
+				return 0;
+			prd[0] = phys;
+			prd[1] = len;
+			last = prd;
+			prd += 2;
+		}
+	}
+	if (!last)
+		return 0;
+	last[1] |= PRD_EOT;
+	return 1;
+}
 
-	if (sorting)
+static void dma_intr(void)
+{
+	int drive = this_queue->q_unit;
+	int status = inb(bm_base+BM_STATUS);
+
+	outb(inb(bm_base+BM_COMMAND) & ~BM_START,bm_base+BM_COMMAND);
+	outb(status|BM_STAT_INTR|BM_STAT_ERR,bm_base+BM_STATUS);
+	if (status & BM_STAT_ERR) {
+		printk("hd%d: DMA error, using PIO\n\r",drive);
+		hd_dma[drive] = 0;
+	}
+	if (win_result() || (status & BM_STAT_ERR)) {
+		bad_rw_intr();
 		return;
+	}
+	this_request->errors = 0;
+	hd_advance(this_request,this_request->nsector);
+	end_request(this_queue);
+	this_request = NULL;
+	do_request();
+}
+
+/*
+ * hd_start_dma() starts the current request as one DMA transfer. The
+ * drive then interrupts only once, when all of it is done.
+ */
+static void hd_start_dma(int drive, int write)
+{
+	barrier();
+	outb(0,bm_base+BM_COMMAND);
+	outl(virt_to_phys((unsigned long) prd_table),bm_base+BM_PRD);
+	outb(inb(bm_base+BM_STATUS)|BM_STAT_INTR|BM_STAT_ERR,
+		bm_base+BM_STATUS);
+	outb(write ? 0 : BM_TOMEM,bm_base+BM_COMMAND);
+	hd_out(drive,this_request->nsector,this_request->sector,
+		hd_dma_cmd[hd_lba48[drive]][write],&dma_intr);
+	outb(inb(bm_base+BM_COMMAND)|BM_START,bm_base+BM_COMMAND);
+}
+
+/*
+ * do_request() starts the next command. It runs with interrupts off:
+ * hd_poll_fn() may be called from the timer, and must never see
+ * hd_polled for the new request while do_hd, or the bus master, are
+ * still those of the last one. It is called with them off, or from the
+ * hd interrupt, whose iret turns them back on.
+ */
+static void do_request(void)
+{
+	int i,r,drive;
+	unsigned char * cmd;
+
+	cli();
 	if (!this_request) {
-		do_hd=NULL;
+		for (i=0 ; i<nr_hd ; i++) {
+			this_queue = hd_queue + (next_drive+i) % nr_hd;
+			if (this_request = blk_fetch_request(this_queue))
+				break;
+		}
+		if (!this_request) {
+			do_hd=NULL;
+			return;
+		}
+		next_drive = this_queue->q_unit+1;
+	}
+	drive = this_queue->q_unit;
+	hd_polled = blk_polled(this_request);
+	if (hd_dma[drive] && hd_build_prd(this_request)) {
+		hd_start_dma(drive,this_request->cmd == WRITE);
 		return;
 	}
-	if (this_request->cmd == WIN_WRITE) {
-		hd_out(this_request->hd,this_request->nsector,this_request->
-			sector,this_request->head,this_request->cyl,
-			this_request->cmd,&write_intr);
+	cmd = hd_cmd[hd_lba48[drive]][hd_mult[drive] > 1];
+	if (this_request->cmd == WRITE) {
+		hd_out(drive,this_request->nsector,this_request->sector,
+			cmd[1],&write_intr);
 		for(i=0 ; i<3000 && !(r=inb_p(HD_STATUS)&DRQ_STAT) ; i++)
 			/* nothing */ ;
 		if (!r) {
-			reset_hd(this_request->hd);
+			reset_hd(drive);
 			return;
 		}
-		port_write(HD_DATA,this_request->bh->b_data+
-			512*(this_request->nsector&1),256);
-	} else if (this_request->cmd == WIN_READ) {
-		hd_out(this_request->hd,this_request->nsector,this_request->
-			sector,this_request->head,this_request->cyl,
-			this_request->cmd,&read_intr);
+		hd_transfer(this_request,hd_block(this_request,drive),WRITE);
+	} else if (this_request->cmd == READ) {
+		hd_out(drive,this_request->nsector,this_request->sector,
+			cmd[0],&read_intr);
 	} else
 		panic("unknown hd-command");
 }
 
 /*
- * add-request adds a request to the linked list.
- * It sets the 'sorting'-variable when doing something
- * that interrupts shouldn't touch.
+ * hd_request_fn() is called when ll_rw_blk.c has queued a request. If
+ * the controller is idle, nothing else will start it, so we do.
  */
-static void add_request(struct hd_request * req)
+static void hd_request_fn(struct request_queue * q)
 {
-	struct hd_request * tmp;
+	cli();
+	if (!do_hd)
+		do_request();
+	sti();
+}
 
-	if (req->nsector != 2)
-		panic("nsector!=2 not implemented");
 /*
- * Not to mess up the linked lists, we never touch the two first
- * entries (not this_request, as it is used by current interrups,
- * and not this_request->next, as it can be assigned to this_request).
- * This is not too high a price to pay for the ability of not
- * disabling interrupts.
+ * hd_ready() tells whether the drive is done with the command in flight,
+ * or with the next block of it, so that handler can run. The alternate
+ * status doesn't end the interrupt, so the routine still finds it all as
+ * it expects. A PIO read is ready when the drive asks for the data to be
+ * taken, or reports an error: not being busy alone isn't enough. A DMA
+ * transfer is done when the bus master has stopped as well: the drive
+ * may be neither busy nor asking for data while it runs.
  */
-	sorting=1;
-	if (!(tmp=this_request))
-		this_request=req;
-	else {
-		if (!(tmp->next))
-			tmp->next=req;
-		else {
-			tmp=tmp->next;
-			for ( ; tmp->next ; tmp=tmp->next)
-				if ((IN_ORDER(tmp,req) ||
-				    !IN_ORDER(tmp,tmp->next)) &&
-				    IN_ORDER(req,tmp->next))
-					break;
-			req->next=tmp->next;
-			tmp->next=req;
-		}
-	}
-	sorting=0;
+static int hd_ready(void (*handler)(void))
+{
+	int status;
+
+	if ((status = inb_p(HD_ALTSTATUS)) & BUSY_STAT)
+		return 0;
+	if (handler == &read_intr && !(status & (DRQ_STAT|ERR_STAT)))
+		return 0;
+	if (handler == &dma_intr && ((status & DRQ_STAT) ||
+	    (inb(bm_base+BM_STATUS) & BM_STAT_ACTIVE)))
+		return 0;
+	return 1;
+}
+
 /*
- * NOTE! As a result of sorting, the interrupts may have died down,
- * as they aren't redone due to locking with sorting=1. They might
- * also never have started, if this is the first request in the queue,
- * so we restart them if necessary.
+ * hd_unpoll() gives the command in flight back to the interrupt once no
+ * task spins for it any more: left polled, only blk_poll_timer() would
+ * move it on, a block per tick. A drive that finished while nIEN was set
+ * may or may not interrupt when it is cleared, so IRQ14 is masked while
+ * we look. If it is done we run the handler ourselves: that reads the
+ * status, which takes the interrupt back before it is unmasked.
  */
-	if (!do_hd)
-		do_request();
+static void hd_unpoll(void (*handler)(void))
+{
+	outb(inb_p(0xA1)|0x40,0xA1);
+	outb(0,HD_CMD);
+	hd_polled = 0;
+	if (hd_ready(handler))
+		handler();
+	outb(inb_p(0xA1)&0xbf,0xA1);
+}
+
+/*
+ * hd_poll_fn() runs the interrupt routine by hand for a polled command.
+ * Both drives share the controller, so q doesn't matter. Called with
+ * interrupts off.
+ */
+static void hd_poll_fn(struct request_queue * q)
+{
+	void (*handler)(void);
+
+	if (!hd_polled || !(handler = do_hd))
+		return;
+	if (!blk_polled(this_request))
+		hd_unpoll(handler);
+	else if (hd_ready(handler))
+		handler();
+}
+
+/* PCI configuration space, mechanism #1 - bus 0 is all we look at */
+static unsigned int pci_read(int dev, int fn, int reg)
+{
+	outl(0x80000000 | (dev<<11) | (fn<<8) | (reg & 0xfc),0xCF8);
+	return inl(0xCFC);
+}
+
+static void pci_write(int dev, int fn, int reg, unsigned int val)
+{
+	outl(0x80000000 | (dev<<11) | (fn<<8) | (reg & 0xfc),0xCF8);
+	outl(val,0xCFC);
+}
+
+/*
+ * hd_find_dma() looks for an IDE controller that can do bus-master DMA,
+ * such as the PIIX3 qemu has, and turns on its bus mastering.
+ */
+static void hd_find_dma(void)
+{
+	unsigned int id, class, bar;
+	int dev, fn;
+
+	for (dev=0 ; dev<32 ; dev++)
+		for (fn=0 ; fn<8 ; fn++) {
+			if (((id = pci_read(dev,fn,0)) & 0xffff) == 0xffff) {
+				if (!fn)
+					break;
+				continue;
+			}
+			class = pci_read(dev,fn,8);
+			if ((class >> 16) != 0x0101 || !(class & 0x8000))
+				continue;
+			bar = pci_read(dev,fn,0x20);
+			if (!(bar & 1) || !(bar & 0xfff0))
+				continue;
+			if (!(prd_table = (unsigned int *) get_free_page()))
+				return;
+			pci_write(dev,fn,4,pci_read(dev,fn,4) | 5);
+			bm_base = bar & 0xfff0;
+			printk("hd: bus-master DMA on %04x:%04x, I/O %04x\n\r",
+				id & 0xffff,id >> 16,bm_base);
+			return;
+		}
 }
 
-void rw_abs_hd(int rw,unsigned int nr,unsigned int sec,unsigned int head,
-	unsigned int cyl,struct buffer_head * bh)
+/*
+ * hd_poll() waits for the status bits in mask to read as val, for the
+ * polled commands of hd_init(). It returns 0 on a time-out or an error.
+ */
+static int hd_poll(int mask, int val)
 {
-	struct hd_request * req;
+	int i, r = 0;
 
-	if (rw!=READ && rw!=WRITE)
-		panic("Bad hd command, must be R/W");
-	lock_buffer(bh);
-repeat:
-	for (req=0+request ; req<NR_REQUEST+request ; req++)
-		if (req->hd<0)
+	for (i=0 ; i<100000 ; i++)
+		if (!((r = inb_p(HD_STATUS)) & BUSY_STAT) && (r & mask) == val)
 			break;
-	if (req==NR_REQUEST+request) {
-		sleep_on(&wait_for_request);
-		goto repeat;
+	return i<100000 && !(r & ERR_STAT);
+}
+
+/*
+ * hd_setup_drive() asks a drive who it is and how big it is, and if it
+ * can do READ/WRITE MULTIPLE, switches that on with the largest block it
+ * supports. It returns 0 if there is no drive, or one we can't use as it
+ * doesn't do LBA. It is run before the hd interrupt is set up, so it
+ * polls, with the drive's interrupt switched off.
+ */
+static int hd_setup_drive(int drive)
+{
+	unsigned short * id = hd_ident[drive];
+	unsigned int size;
+	int mult;
+
+	outb(CTL_NIEN,HD_CMD);
+	outb_p(0xA0|(drive<<4),HD_CURRENT);
+	outb_p(WIN_IDENTIFY,HD_COMMAND);
+	if (!hd_poll(DRQ_STAT,DRQ_STAT)) {
+		outb(0,HD_CMD);
+		return 0;
 	}
-	req->hd=nr;
-	req->nsector=2;
-	req->sector=sec;
-	req->head=head;
-	req->cyl=cyl;
-	req->cmd = ((rw==READ)?WIN_READ:WIN_WRITE);
-	req->bh=bh;
-	req->errors=0;
-	req->next=NULL;
-	add_request(req);
-	wait_on_buffer(bh);
+	port_read(HD_DATA,id,256);
+	if (!(id[49] & 0x200)) {
+		outb(0,HD_CMD);
+		printk("hd%d: no LBA, not used\n\r",drive);
+		return 0;
+	}
+	if (id[83] & 0x400) {
+		hd_lba48[drive] = 1;
+		size = id[100] | (id[101] << 16);
+		if (id[102] || id[103])
+			size = 0xffffffff;
+	} else
+		size = id[60] | (id[61] << 16);
+	hd[drive*5].start_sect = 0;
+	hd[drive*5].nr_sects = size;
+	hd_dma[drive] = bm_base && (id[49] & 0x100);
+	for (mult = id[47] & 0xff ; mult & (mult-1) ; )
+		mult &= mult-1;
+	if (mult < 2)
+		goto out;
+	outb_p(mult,HD_NSECTOR);
+	outb_p(0xA0|(drive<<4),HD_CURRENT);
+	outb_p(WIN_SETMULT,HD_COMMAND);
+	if (hd_poll(0,0))
+		hd_mult[drive] = mult;
+out:
+	outb(0,HD_CMD);
+	printk("hd%d: %dMB, LBA%d, %s, %d sector%s per interrupt\n\r",drive,
+		(int) (size>>11),hd_lba48[drive]?48:28,hd_dma[drive]?"DMA":"PIO",
+		hd_mult[drive],(hd_mult[drive]>1)?"s":"");
+	return 1;
 }
 
 void hd_init(void)
 {
 	int i;
 
-	for (i=0 ; i<NR_REQUEST ; i++) {
-		request[i].hd = -1;
-		request[i].next = NULL;
-	}
-	for (i=0 ; i<NR_HD ; i++) {
-		hd[i*5].start_sect = 0;
-		hd[i*5].nr_sects = hd_info[i].head*
-				hd_info[i].sect*hd_info[i].cyl;
+	hd_find_dma();
+	while (nr_hd<MAX_HD && hd_setup_drive(nr_hd))
+		nr_hd++;
+	for (i=0 ; i<nr_hd ; i++) {
+		blk_init_queue(hd_queue+i,hd_names[i],i,MAX_SECTORS,
+			hd_request_fn);
+		hd_queue[i].q_poll_fn = hd_poll_fn;
 	}
+	register_blkdev(3,hd_map);
+	blksize_size[3] = hd_blocksizes;	/* major 3 is hd */
 	set_trap_gate(0x2E,&hd_interrupt);
 	outb_p(inb_p(0x21)&0xfb,0x21);
 	outb(inb_p(0xA1)&0xbf,0xA1);
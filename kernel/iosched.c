@@ -0,0 +1,156 @@
+/*
+ * iosched.c holds the I/O schedulers a request queue can use:
+ *
+ * elevator - the old one-way elevator: requests are kept in ascending
+ *	sector order from the head, wrapping around once.
+ * deadline - the same sweep, but every request also goes on a FIFO for
+ *	its direction, and one that has waited READ_EXPIRE (WRITE_EXPIRE)
+ *	goes next, wherever it is. Reads are swept before writes, as
+ *	somebody is usually waiting for them.
+ * noop     - first come, first served, for devices that don't seek.
+ *
+ * All of them merge, as ll_rw_blk.c does that before it calls s_add().
+ */
+
+#include <errno.h>
+
+#include <linux/config.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <asm/system.h>
+
+#define IN_ORDER(s1,s2) ((s1)->sector < (s2)->sector)
+
+/*
+ * The head of the queue is never moved if the driver is working on it,
+ * but it may be when the queue is idle, as then s_next() hasn't picked.
+ */
+static inline struct request ** first_free(struct request_queue * q)
+{
+	return (q->q_head && q->q_busy) ? &q->q_head->next : &q->q_head;
+}
+
+static void elevator_add(struct request_queue * q, struct request * req)
+{
+	struct request * tmp;
+
+	if (!(tmp = q->q_head)) {
+		q->q_head = req;
+		return;
+	}
+	for ( ; tmp->next ; tmp = tmp->next)
+		if ((IN_ORDER(tmp,req) ||
+		    !IN_ORDER(tmp,tmp->next)) &&
+		    IN_ORDER(req,tmp->next))
+			break;
+	req->next = tmp->next;
+	tmp->next = req;
+}
+
+static struct request * head_next(struct request_queue * q)
+{
+	return q->q_head;
+}
+
+/*
+ * deadline keeps the queue sorted by sector, and sweeps it upwards from
+ * where the last request ended, as the elevator does.
+ */
+static void deadline_add(struct request_queue * q, struct request * req)
+{
+	struct request ** p, ** fifo;
+
+	for (p = first_free(q) ; *p && !IN_ORDER(req,*p) ; p = &(*p)->next)
+		/* nothing */ ;
+	req->next = *p;
+	*p = req;
+	for (fifo = q->q_fifo + req->cmd ; *fifo ; fifo = &(*fifo)->fifo_next)
+		/* nothing */ ;
+	req->fifo_next = NULL;
+	*fifo = req;
+}
+
+static struct request * deadline_sweep(struct request_queue * q, int cmd)
+{
+	struct request * req, * first = NULL;
+
+	for (req = q->q_head ; req ; req = req->next) {
+		if (req->cmd != cmd)
+			continue;
+		if (req->sector >= q->q_last_sector)
+			return req;
+		if (!first)
+			first = req;
+	}
+	return first;
+}
+
+static struct request * deadline_next(struct request_queue * q)
+{
+	struct request * req, ** fifo;
+
+	if ((req = q->q_fifo[READ]) && jiffies >= req->expires)
+		q->q_expired++;
+	else if ((req = q->q_fifo[WRITE]) && jiffies >= req->expires)
+		q->q_expired++;
+	else if (!(req = deadline_sweep(q,q->q_fifo[READ]?READ:WRITE)))
+		req = q->q_head;
+	for (fifo = q->q_fifo + req->cmd ; *fifo ; fifo = &(*fifo)->fifo_next)
+		if (*fifo == req) {
+			*fifo = req->fifo_next;
+			break;
+		}
+	req->fifo_next = NULL;
+	return req;
+}
+
+static void noop_add(struct request_queue * q, struct request * req)
+{
+	struct request ** p;
+
+	for (p = &q->q_head ; *p ; p = &(*p)->next)
+		/* nothing */ ;
+	*p = req;
+}
+
+static struct iosched schedulers[] = {
+	{"elevator", elevator_add, head_next},
+	{"deadline", deadline_add, deadline_next},
+	{"noop", noop_add, head_next},
+	{NULL, NULL, NULL}};
+
+struct iosched * find_iosched(char * name)
+{
+	struct iosched * s;
+	char * a, * b;
+
+	for (s = schedulers ; s->s_name ; s++) {
+		for (a=name, b=s->s_name ; *a && *a == *b ; a++,b++)
+			/* nothing */ ;
+		if (*a == *b)
+			return s;
+	}
+	return NULL;
+}
+
+/*
+ * set_iosched() switches q to another scheduler. The requests already
+ * queued stay where they are, and are taken off the deadline FIFOs:
+ * they are still sent, but can't expire.
+ */
+int set_iosched(struct request_queue * q, char * name)
+{
+	struct iosched * s;
+	struct request * req;
+
+	if (!(s = find_iosched(name)))
+		return -EINVAL;
+	cli();
+	for (req = q->q_head ; req ; req = req->next)
+		req->fifo_next = NULL;
+	q->q_fifo[READ] = q->q_fifo[WRITE] = NULL;
+	q->q_sched = s;
+	sti();
+	return 0;
+}
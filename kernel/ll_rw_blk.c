@@ -0,0 +1,521 @@
+/*
+ * ll_rw_blk.c is the part of the block device code that doesn't depend
+ * on the device: it turns buffers into requests, keeps a queue of them
+ * per device, merging neighbours, and hands them to the driver in the
+ * order the queue's scheduler (iosched.c) picks. Requests come from one
+ * pool, but each queue may only hold q_depth of them, so one busy device
+ * can't starve the others.
+ */
+
+#include <errno.h>
+
+#include <linux/config.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <asm/system.h>
+
+static struct request all_requests[NR_REQUEST];
+static struct request * free_requests = NULL;
+static int nr_free_requests = 0;
+static struct task_struct * wait_for_request = NULL;
+
+static blk_map_fn blk_dev[NR_BLK_DEV] = {NULL, };
+struct request_queue * blk_queues[NR_QUEUES] = {NULL, };
+
+static inline void lock_buffer(struct buffer_head * bh)
+{
+	if (bh->b_lock)
+		printk("ll_rw_blk.c: buffer multiply locked\n");
+	bh->b_lock=1;
+}
+
+static inline void unlock_buffer(struct buffer_head * bh)
+{
+	if (!bh->b_lock)
+		printk("ll_rw_blk.c: free buffer being unlocked\n");
+	bh->b_lock=0;
+	wake_up(&bh->b_wait);
+}
+
+void register_blkdev(int major, blk_map_fn map)
+{
+	if (major >= NR_BLK_DEV)
+		panic("register_blkdev: bad major");
+	blk_dev[major] = map;
+}
+
+static void reset_one(struct request_queue * q)
+{
+	int i;
+
+	q->q_requests = q->q_back_merges = q->q_front_merges = 0;
+	q->q_expired = 0;
+	q->q_poll_done = q->q_poll_slept = 0;
+	for (i=0 ; i<NR_LAT ; i++)
+		q->q_lat[0][i] = q->q_lat[1][i] = 0;
+}
+
+void blk_init_queue(struct request_queue * q, char * name, int unit,
+	int max_sectors, void (*request_fn)(struct request_queue * q))
+{
+	int i;
+
+	q->q_name = name;
+	q->q_head = NULL;
+	q->q_busy = 0;
+	q->q_count = 0;
+	q->q_depth = QUEUE_DEPTH;
+	q->q_max_sectors = max_sectors;
+	q->q_unit = unit;
+	q->q_request_fn = request_fn;
+	q->q_wait = NULL;
+	if (!(q->q_sched = find_iosched(IO_SCHED)))
+		panic("blk_init_queue: no IO_SCHED");
+	q->q_fifo[READ] = q->q_fifo[WRITE] = NULL;
+	q->q_last_sector = 0;
+	q->q_poll = 0;
+	q->q_poll_fn = NULL;
+	reset_one(q);
+	for (i=0 ; i<NR_QUEUES ; i++)
+		if (!blk_queues[i]) {
+			blk_queues[i] = q;
+			return;
+		}
+	panic("blk_init_queue: too many queues");
+}
+
+struct request_queue * find_queue(char * name)
+{
+	char * a, * b;
+	int i;
+
+	for (i=0 ; i<NR_QUEUES && blk_queues[i] ; i++) {
+		for (a=name, b=blk_queues[i]->q_name ; *a && *a == *b ; a++,b++)
+			/* nothing */ ;
+		if (*a == *b)
+			return blk_queues[i];
+	}
+	return NULL;
+}
+
+/*
+ * set_queue_depth() changes how many requests q may hold. Lowering it
+ * doesn't throw out any: new ones just wait until enough have drained.
+ */
+int set_queue_depth(struct request_queue * q, int depth)
+{
+	if (depth < 1 || depth > NR_REQUEST)
+		return -EINVAL;
+	q->q_depth = depth;
+	wake_up(&q->q_wait);
+	return 0;
+}
+
+void reset_queue_stats(void)
+{
+	int i;
+
+	for (i=0 ; i<NR_QUEUES && blk_queues[i] ; i++)
+		reset_one(blk_queues[i]);
+}
+
+/*
+ * get_request() takes a request from the pool for q, waiting if q is
+ * full or the pool is empty. As read-ahead is only a hint, READA never
+ * waits, and may only use the first half of the pool so that it can't
+ * crowd out real reads and writes.
+ */
+static struct request * get_request(struct request_queue * q, int rw)
+{
+	struct request * req;
+
+	cli();
+	while (q->q_count >= q->q_depth || !free_requests ||
+	    (rw == READA && nr_free_requests <= NR_REQUEST/2)) {
+		if (rw == READA) {
+			sti();
+			return NULL;
+		}
+		if (q->q_count >= q->q_depth)
+			sleep_on(&q->q_wait);
+		else
+			sleep_on(&wait_for_request);
+	}
+	req = free_requests;
+	free_requests = req->next;
+	nr_free_requests--;
+	q->q_count++;
+	sti();
+	req->next = NULL;
+	return req;
+}
+
+static void put_request(struct request_queue * q, struct request * req)
+{
+	req->bh = NULL;
+	req->next = free_requests;
+	free_requests = req;
+	nr_free_requests++;
+	q->q_count--;
+	wake_up(&q->q_wait);
+	wake_up(&wait_for_request);
+}
+
+/*
+ * blk_fetch_request() gives the driver the request to work on next, or
+ * NULL if q is empty. Once it has picked one, it moves it to the head
+ * and marks q busy, and keeps returning it until end_request().
+ */
+struct request * blk_fetch_request(struct request_queue * q)
+{
+	struct request * req, ** p;
+
+	if (!q->q_head)
+		return NULL;
+	if (!q->q_busy) {
+		req = q->q_sched->s_next(q);
+		for (p = &q->q_head ; *p != req ; p = &(*p)->next)
+			/* nothing */ ;
+		*p = req->next;
+		req->next = q->q_head;
+		q->q_head = req;
+		q->q_busy = 1;
+		q->q_last_sector = req->sector + req->nsector;
+	}
+	return q->q_head;
+}
+
+/*
+ * end_request() is called by the driver, usually from its interrupt,
+ * when it is done with the request at the head of q, and has ended all
+ * its buffers.
+ */
+void end_request(struct request_queue * q)
+{
+	struct request * req = q->q_head;
+
+	q->q_head = req->next;
+	q->q_busy = 0;
+	put_request(q,req);
+}
+
+/*
+ * merge_request() tries to add req onto the end (back merge) or the front
+ * of a queued request in the same direction whose sectors it continues.
+ * The request the driver is working on can't be touched.
+ */
+static int merge_request(struct request_queue * q, struct request * req)
+{
+	struct request * tmp;
+	struct buffer_head * bh;
+
+	for (tmp = q->q_head ; tmp ; tmp = tmp->next) {
+		if ((tmp == q->q_head && q->q_busy) || tmp->cmd != req->cmd ||
+		    tmp->nsector + req->nsector > q->q_max_sectors)
+			continue;
+		if (tmp->sector + tmp->nsector == req->sector) {
+			for (bh = tmp->bh ; bh->b_reqnext ; bh = bh->b_reqnext)
+				/* nothing */ ;
+			bh->b_reqnext = req->bh;
+			q->q_back_merges++;
+		} else if (req->sector + req->nsector == tmp->sector) {
+			for (bh = req->bh ; bh->b_reqnext ; bh = bh->b_reqnext)
+				/* nothing */ ;
+			bh->b_reqnext = tmp->bh;
+			tmp->bh = req->bh;
+			tmp->sector = req->sector;
+			q->q_front_merges++;
+		} else
+			continue;
+		tmp->nsector += req->nsector;
+		tmp->poll |= req->poll;
+		put_request(q,req);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * add_request() merges req into a queued request, or gives it to the
+ * scheduler, and then lets the driver know. The lists are short, so we
+ * simply keep interrupts off while we touch them.
+ */
+static void add_request(struct request_queue * q, struct request * req)
+{
+	if (!req->nsector)
+		panic("empty request");
+	q->q_requests++;
+	cli();
+	if (!merge_request(q,req))
+		q->q_sched->s_add(q,req);
+	sti();
+	q->q_request_fn(q);
+}
+
+/*
+ * end_buffer_io() is called by the drivers, from their interrupt, as
+ * each buffer of a request is done. Once the buffer is unlocked it runs
+ * its completion callback, if submit_bh() gave it one. That runs in the
+ * interrupt too, so it must not sleep.
+ */
+void end_buffer_io(struct buffer_head * bh, int uptodate)
+{
+	void (*end_io)(struct buffer_head *, int) = bh->b_end_io;
+
+	bh->b_end_io = NULL;
+	bh->b_uptodate = uptodate;
+	if (uptodate)
+		bh->b_dirt = 0;
+	unlock_buffer(bh);
+	if (end_io)
+		end_io(bh,uptodate);
+}
+
+/*
+ * unchain() takes apart a chain that won't be sent after all. Its
+ * callbacks are still run, so that a caller that counts them doesn't
+ * wait forever, but they are told the I/O wasn't done.
+ */
+static void unchain(struct buffer_head * bh, int unlock)
+{
+	void (*end_io)(struct buffer_head *, int);
+	struct buffer_head * tmp;
+
+	for ( ; bh ; bh = tmp) {
+		tmp = bh->b_reqnext;
+		bh->b_reqnext = NULL;
+		if (unlock)
+			unlock_buffer(bh);
+		if (end_io = bh->b_end_io) {
+			bh->b_end_io = NULL;
+			end_io(bh,0);
+		}
+	}
+}
+
+/*
+ * make_request() turns a buffer, or a b_reqnext chain of consecutive
+ * blocks, into one request for the whole run.
+ */
+static void make_request(blk_map_fn map, int rw, struct buffer_head * bh,
+	int poll)
+{
+	struct request_queue * q;
+	struct request * req;
+	struct buffer_head * tmp;
+	unsigned int sector, nsect;
+
+	sector = bh->b_blocknr * (bh->b_size >> 9);
+	for (nsect=0,tmp=bh ; tmp ; tmp=tmp->b_reqnext)
+		nsect += tmp->b_size >> 9;
+	if (!(q = map(bh->b_dev,&sector,nsect)) || (rw==READA && bh->b_lock)) {
+		unchain(bh,0);
+		return;
+	}
+	if (nsect > q->q_max_sectors)
+		panic("make_request: request too long");
+	for (tmp=bh ; tmp ; tmp=tmp->b_reqnext)
+		lock_buffer(tmp);
+	if (!(req = get_request(q,rw))) {
+		unchain(bh,1);
+		return;
+	}
+	req->cmd = (rw==WRITE)?WRITE:READ;
+	req->errors = 0;
+	req->sector = sector;
+	req->nsector = nsect;
+	req->offset = 0;
+	req->bh = bh;
+	req->expires = jiffies + ((rw==WRITE)?WRITE_EXPIRE:READ_EXPIRE);
+	req->fifo_next = NULL;
+	req->poll = poll;
+	add_request(q,req);
+}
+
+/*
+ * ll_rw_block() only starts the I/O - use wait_on_buffer() to wait for
+ * it to complete. READA requests may be dropped silently if the buffer
+ * is already locked or the device is busy. bh may be the head of a
+ * b_reqnext chain of consecutive blocks, which the driver then does as
+ * one transfer; it clears b_reqnext as the blocks complete.
+ */
+static void rw_block(int rw, struct buffer_head * bh, int poll)
+{
+	unsigned int major;
+
+	if (rw!=READ && rw!=WRITE && rw!=READA)
+		panic("Bad block dev command, must be R/W/RA");
+	if ((major=MAJOR(bh->b_dev)) >= NR_BLK_DEV || !blk_dev[major])
+		panic("Trying to read nonexistent block-device");
+	make_request(blk_dev[major],rw,bh,poll);
+}
+
+void ll_rw_block(int rw, struct buffer_head * bh)
+{
+	rw_block(rw,bh,0);
+}
+
+static inline void wait_on_buffer(struct buffer_head * bh)
+{
+	cli();
+	while (bh->b_lock)
+		sleep_on(&bh->b_wait);
+	sti();
+}
+
+/*
+ * Latencies are counted in buckets a quarter of a power of two wide:
+ * from 4 cycles up, bucket 4*(n-1)+s holds (4+s)<<(n-2) up to
+ * (5+s)<<(n-2). That is good to 25%, in NR_LAT buckets.
+ */
+static int lat_bucket(unsigned long c)
+{
+	int n, b;
+
+	if (c < 4)
+		return c;
+	for (n=2 ; c >> (n+1) ; n++)
+		/* nothing */ ;
+	b = 4*(n-1) + ((c >> (n-2)) & 3);
+	return (b < NR_LAT) ? b : NR_LAT-1;
+}
+
+static unsigned long lat_limit(int b)
+{
+	if (b < 4)
+		return b+1;
+	return (unsigned long) (5 + b%4) << (b/4 - 1);
+}
+
+/*
+ * blk_latency() returns the latency, in TSC cycles, that 'percent' of the
+ * poll_rw_block() calls on q stayed within, in one mode, and puts the
+ * number of calls in *nr.
+ */
+unsigned long blk_latency(struct request_queue * q, int poll, int percent,
+	unsigned long * nr)
+{
+	unsigned long total = 0, sum = 0;
+	int i;
+
+	for (i=0 ; i<NR_LAT ; i++)
+		total += q->q_lat[poll][i];
+	if (!(*nr = total))
+		return 0;
+	for (i=0 ; i<NR_LAT ; i++)
+		if ((sum += q->q_lat[poll][i]) * 100 >= total * percent)
+			break;
+	return lat_limit(i);
+}
+
+static struct request_queue * bh_queue(struct buffer_head * bh)
+{
+	unsigned int major = MAJOR(bh->b_dev);
+	unsigned int sector = bh->b_blocknr * (bh->b_size >> 9);
+
+	if (major >= NR_BLK_DEV || !blk_dev[major])
+		return NULL;
+	return blk_dev[major](bh->b_dev,&sector,bh->b_size >> 9);
+}
+
+/*
+ * blk_polled() tells the driver whether to start req with the interrupt
+ * off: only if a task is still spinning for one of its buffers. One that
+ * ran out of budget, maybe while req waited behind others, doesn't count,
+ * or the request would have to wait for blk_poll_timer().
+ */
+int blk_polled(struct request * req)
+{
+	struct buffer_head * bh;
+
+	if (!req->poll)
+		return 0;
+	for (bh = req->bh ; bh ; bh = bh->b_reqnext)
+		if (bh->b_poll)
+			return 1;
+	return 0;
+}
+
+/*
+ * poll_rw_block() is ll_rw_block() and wait_on_buffer() in one, for a
+ * task that wants a block as soon as possible. On a queue in poll mode
+ * the request is started with the device's interrupt off, and the task
+ * spins on the driver's q_poll_fn(), which finishes the I/O in-line:
+ * there is no interrupt and no wake-up to wait for. After POLL_BUDGET
+ * cycles it gives up and sleeps. Its last call of q_poll_fn() then sees
+ * that nobody polls any more, and goes back to the interrupt. Either way
+ * the time it took goes into q_lat.
+ */
+void poll_rw_block(int rw, struct buffer_head * bh)
+{
+	struct request_queue * q = bh_queue(bh);
+	unsigned long start = rdtsc();
+	int poll = q && q->q_poll && q->q_poll_fn;
+
+	bh->b_poll = poll;
+	rw_block(rw,bh,poll);
+	if (poll) {
+		while (bh->b_lock && rdtsc() - start < POLL_BUDGET) {
+			cli();
+			q->q_poll_fn(q);
+			sti();
+		}
+		bh->b_poll = 0;
+		if (bh->b_lock) {
+			cli();
+			q->q_poll_fn(q);
+			sti();
+			q->q_poll_slept++;
+		} else
+			q->q_poll_done++;
+	}
+	wait_on_buffer(bh);
+	if (q && bh->b_uptodate)
+		q->q_lat[poll][lat_bucket(rdtsc() - start)]++;
+}
+
+/*
+ * blk_poll_timer() is called by do_timer() on every tick, with interrupts
+ * off. poll_rw_block() hands a request back to the interrupt itself when
+ * it gives up, so this is only a last resort, for polled I/O nobody
+ * looks after. Drivers keep it cheap when they have nothing polled in
+ * flight.
+ */
+void blk_poll_timer(void)
+{
+	int i;
+
+	for (i=0 ; i<NR_QUEUES && blk_queues[i] ; i++)
+		if (blk_queues[i]->q_poll_fn)
+			blk_queues[i]->q_poll_fn(blk_queues[i]);
+}
+
+/*
+ * submit_bh() is ll_rw_block() with a completion callback: end_io is
+ * called once for every buffer of the chain, with private in b_private,
+ * when its I/O is done (see end_buffer_io()). The caller doesn't have to
+ * wait for anything, and doesn't need a task of its own per I/O in flight.
+ */
+void submit_bh(int rw, struct buffer_head * bh,
+	void (*end_io)(struct buffer_head * bh, int uptodate), void * private)
+{
+	struct buffer_head * tmp;
+
+	for (tmp=bh ; tmp ; tmp=tmp->b_reqnext) {
+		tmp->b_end_io = end_io;
+		tmp->b_private = private;
+	}
+	ll_rw_block(rw,bh);
+}
+
+void blk_dev_init(void)
+{
+	int i;
+
+	for (i=0 ; i<NR_REQUEST ; i++) {
+		all_requests[i].next = free_requests;
+		free_requests = all_requests+i;
+	}
+	nr_free_requests = NR_REQUEST;
+}
@@ -6,6 +6,7 @@
  */
 #include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/blkdev.h>
 #include <signal.h>
 #include <linux/sys.h>
 #include <asm/system.h>
@@ -184,6 +185,9 @@ void wake_up(struct task_struct **p)
 
 void do_timer(long cpl)
 {
+	if (bdflush_interval > 0 && !(jiffies % bdflush_interval))
+		wake_up(&bdflush_wait);
+	blk_poll_timer();
 	if (cpl)
 		current->utime++;
 	else
@@ -20,9 +20,12 @@
 #include <linux/config.h>
 #include <linux/head.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <asm/system.h>
 
 int do_exit(long code);
+int shrink_buffers(int nr);
+int shrink_page_cache(int nr);
 
 /* PML4 is at physical address 0x1000 */
 #define PML4_ADDR 0x1000
@@ -77,21 +80,47 @@ static inline void copy_page(unsigned long from, unsigned long to)
 		dst[i] = src[i];
 }
 
+#define USED 100
+
 static unsigned short mem_map [ PAGING_PAGES ] = {0,};
 
+long nr_free_pages = PAGING_PAGES;
+
+/*
+ * mem_init() marks the pages above the end of the memory that was found
+ * as used, so that get_free_page() never hands them out.
+ */
+void mem_init(unsigned long end_mem)
+{
+	int i;
+
+	nr_free_pages = 0;
+	for (i = 0; i < PAGING_PAGES; i++)
+		if (LOW_MEM + ((unsigned long) i << 12) >= end_mem)
+			mem_map[i] = USED;
+		else if (!mem_map[i])
+			nr_free_pages++;
+}
+
 /*
  * Get physical address of first (actually last :-) free page, and mark it
- * used. If no free pages left, return 0.
+ * used. If no free pages left, return 0. When free pages run low, the
+ * buffer and page caches are asked to give some of their pages back first.
  */
 unsigned long get_free_page(void)
 {
 	int i;
 	unsigned long page;
 	
+	if (nr_free_pages < MIN_FREE_PAGES)
+		shrink_buffers(MIN_FREE_PAGES - nr_free_pages);
+	if (nr_free_pages < MIN_FREE_PAGES)
+		shrink_page_cache(MIN_FREE_PAGES - nr_free_pages);
 	/* Search backwards for a free page */
 	for (i = PAGING_PAGES - 1; i >= 0; i--) {
 		if (mem_map[i] == 0) {
 			mem_map[i] = 1;
+			nr_free_pages--;
 			page = LOW_MEM + (i << 12);
 			/* Zero the page */
 			{
@@ -116,7 +145,11 @@ void free_page(unsigned long addr)
 		panic("trying to free nonexistent page");
 	addr -= LOW_MEM;
 	addr >>= 12;
-	if (mem_map[addr]--) return;
+	if (mem_map[addr]--) {
+		if (!mem_map[addr])
+			nr_free_pages++;
+		return;
+	}
 	mem_map[addr] = 0;
 	panic("trying to free free page");
 }
@@ -206,6 +239,22 @@ static unsigned long *get_pte(unsigned long addr, int create)
 	return &pt[PT_INDEX(addr)];
 }
 
+/*
+ * virt_to_phys() gives the physical address behind a linear one, for
+ * devices that do DMA, or 0 if there is no page there. Everything below
+ * HIGH_MEMORY is mapped one to one.
+ */
+unsigned long virt_to_phys(unsigned long addr)
+{
+	unsigned long *pte;
+
+	if (addr < HIGH_MEMORY)
+		return addr;
+	if (!(pte = get_pte(addr, 0)) || !(*pte & PAGE_PRESENT))
+		return 0;
+	return PTE_ADDR(*pte) + PAGE_OFFSET(addr);
+}
+
 /*
  * This function frees a continuous block of page tables.
  * For 64-bit, we work in 2MB blocks (one PD entry = 512 PT entries).